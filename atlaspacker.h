@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+// position of a packed rectangle inside the atlas, in texels
+struct AtlasRect
+{
+    int x, y, width, height;
+};
+
+// Skyline bottom-left packer: the free space is the outline of the packed
+// rectangles seen from the top, a list of horizontal segments. A rectangle
+// goes where its top edge ends up lowest, which keeps the outline flat and
+// the waste low for the few dozen sprites a particle atlas holds.
+class SkylinePacker
+{
+public:
+
+    SkylinePacker(int width, int height) : m_width(width), m_height(height)
+    {
+        m_skyline.push_back({ 0, 0, width });
+    }
+
+    // place a width x height rectangle, false if it doesn't fit anymore
+    bool insert(int width, int height, AtlasRect &rect)
+    {
+        std::size_t best = m_skyline.size();
+        int bestTop = std::numeric_limits<int>::max();
+        int bestSegment = std::numeric_limits<int>::max();
+        int bestY = 0;
+        for (std::size_t i = 0; i < m_skyline.size(); ++i)
+        {
+            int y;
+            if (!fits(i, width, height, y))
+                continue;
+            // lowest top edge, then the narrowest segment to keep wide ones free
+            if (y + height < bestTop || (y + height == bestTop && m_skyline[i].width < bestSegment))
+            {
+                best = i;
+                bestTop = y + height;
+                bestSegment = m_skyline[i].width;
+                bestY = y;
+            }
+        }
+        if (best == m_skyline.size())
+            return false;
+
+        rect = { m_skyline[best].x, bestY, width, height };
+        addSegment(best, rect);
+        m_usedArea += static_cast<std::size_t>(width) * height;
+        return true;
+    }
+
+    int getWidth() const { return m_width; }
+    int getHeight() const { return m_height; }
+    // share of the atlas covered by rectangles
+    float getOccupancy() const
+    {
+        return static_cast<float>(m_usedArea) / (static_cast<float>(m_width) * static_cast<float>(m_height));
+    }
+
+private:
+
+    struct Segment
+    {
+        int x, y, width;
+    };
+
+    // y a rectangle starting at segment index rests at, the highest segment under it
+    bool fits(std::size_t index, int width, int height, int &y) const
+    {
+        const int x = m_skyline[index].x;
+        if (x + width > m_width)
+            return false;
+        y = 0;
+        int remaining = width;
+        for (std::size_t i = index; remaining > 0; ++i)
+        {
+            y = std::max(y, m_skyline[i].y);
+            if (y + height > m_height)
+                return false;
+            remaining -= m_skyline[i].width;
+        }
+        return true;
+    }
+
+    // raise the outline over rect, cut the segments it covers and merge equal heights
+    void addSegment(std::size_t index, const AtlasRect &rect)
+    {
+        m_skyline.insert(m_skyline.begin() + index, { rect.x, rect.y + rect.height, rect.width });
+        const int right = rect.x + rect.width;
+        for (std::size_t i = index + 1; i < m_skyline.size();)
+        {
+            Segment &segment = m_skyline[i];
+            if (segment.x >= right)
+                break;
+            const int cut = right - segment.x;
+            if (cut < segment.width)
+            {
+                segment.x += cut;
+                segment.width -= cut;
+                break;
+            }
+            m_skyline.erase(m_skyline.begin() + i);
+        }
+        for (std::size_t i = 0; i + 1 < m_skyline.size();)
+        {
+            if (m_skyline[i].y == m_skyline[i + 1].y)
+            {
+                m_skyline[i].width += m_skyline[i + 1].width;
+                m_skyline.erase(m_skyline.begin() + i + 1);
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
+    int m_width, m_height;
+    std::vector<Segment> m_skyline;
+    std::size_t m_usedArea = 0;
+};
+
+// Pack width x height images into the smallest power of two atlas up to
+// maxSize a side, each with padding texels of border on every side so
+// filtering and the smaller mip levels don't pull in the neighbours. rects
+// receive the images themselves, without the border, in input order.
+// Returns false if they don't fit into maxSize x maxSize.
+inline bool packAtlas(const std::vector<AtlasRect> &sizes, int padding, int maxSize,
+                      int &atlasWidth, int &atlasHeight, std::vector<AtlasRect> &rects)
+{
+    // tallest first, the usual order for a skyline
+    std::vector<std::size_t> order(sizes.size());
+    std::iota(order.begin(), order.end(), std::size_t(0));
+    std::stable_sort(order.begin(), order.end(),
+                     [&sizes](std::size_t a, std::size_t b) { return sizes[a].height > sizes[b].height; });
+
+    std::size_t area = 0;
+    int widest = 1, tallest = 1;
+    for (const AtlasRect &size : sizes)
+    {
+        area += static_cast<std::size_t>(size.width + 2 * padding) * (size.height + 2 * padding);
+        widest = std::max(widest, size.width + 2 * padding);
+        tallest = std::max(tallest, size.height + 2 * padding);
+    }
+
+    // start at the smallest power of two that could hold it all, then grow
+    // the shorter side until everything fits
+    int width = 1, height = 1;
+    while (width < widest)
+        width *= 2;
+    while (height < tallest)
+        height *= 2;
+    while (static_cast<std::size_t>(width) * height < area)
+        (width <= height ? width : height) *= 2;
+
+    rects.assign(sizes.size(), AtlasRect{ 0, 0, 0, 0 });
+    while (width <= maxSize && height <= maxSize)
+    {
+        SkylinePacker packer(width, height);
+        bool packed = true;
+        for (std::size_t index : order)
+        {
+            AtlasRect rect;
+            if (!packer.insert(sizes[index].width + 2 * padding, sizes[index].height + 2 * padding, rect))
+            {
+                packed = false;
+                break;
+            }
+            rects[index] = { rect.x + padding, rect.y + padding, sizes[index].width, sizes[index].height };
+        }
+        if (packed)
+        {
+            atlasWidth = width;
+            atlasHeight = height;
+            return true;
+        }
+        (width <= height ? width : height) *= 2;
+    }
+    return false;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <GL/glew.h>
+
+#include "shaders.hpp"
+#include "particlebackend.h"
+#include "particlesystem.h"
+#include "transformfeedback.h"
+#include "computeparticles.h"
+
+// backend for the context version that was actually obtained: compute
+// shaders and SSBOs need 4.3, anything older keeps the CPU path
+inline ParticleBackendType selectParticleBackend(int majorVersion, int minorVersion)
+{
+    if (majorVersion > 4 || (majorVersion == 4 && minorVersion >= 3))
+        return ParticleBackendType::COMPUTE;
+    return ParticleBackendType::CPU;
+}
+
+// upload the atlas rectangle of every sprite index to the render shader,
+// which must be in use; indexes past the end of rects draw the whole texture
+inline void setParticleSprites(Shader &shader, const std::vector<glm::vec4> &rects)
+{
+    std::vector<glm::vec4> table(maxParticleSprites, glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
+    std::copy_n(rects.begin(), std::min<std::size_t>(rects.size(), table.size()), table.begin());
+    shader.setUniformVec4Array("spriteRects", table.data(), static_cast<GLsizei>(table.size()));
+}
+
+// build the render shader the backend expects, then the backend itself;
+// jobSystem is only used by the CPU backend
+inline std::unique_ptr<ParticleBackend> createParticleBackend(ParticleBackendType type, uint32_t amount,
+                                                              JobSystem *jobSystem = nullptr)
+{
+    Shader shader;
+    shader.loadShader(type == ParticleBackendType::CPU ? shaderVertex : shaderFeedbackRender,
+                      TypeShader::VERTEX_SHADER);
+    shader.loadShader(shaderFragment, TypeShader::FRAGMENT_SHADER);
+    shader.createShaderProgram();
+    // a single texture until the caller hands over an atlas
+    shader.useShaderProgram();
+    setParticleSprites(shader, {});
+
+    switch (type)
+    {
+    case ParticleBackendType::COMPUTE:
+        return std::make_unique<ComputeParticleSystem>(shader, amount);
+    case ParticleBackendType::TRANSFORM_FEEDBACK:
+        return std::make_unique<TransformFeedbackParticleSystem>(shader, amount);
+    case ParticleBackendType::CPU:
+    default:
+    {
+        std::unique_ptr<ParticleSystem> system = std::make_unique<ParticleSystem>(shader, amount);
+        system->setJobSystem(jobSystem);
+        return system;
+    }
+    }
+}
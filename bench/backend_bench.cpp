@@ -0,0 +1,105 @@
+// Frame time and throughput of every particle backend the context supports,
+// from 10k to 10M particles. Tries a GL 4.3 core context for the compute
+// backend and falls back to 3.3 (CPU and transform feedback only). Runs
+// headless through EGL, e.g. on Mesa llvmpipe without a GPU or display.
+//
+// usage: backend_bench [particles...]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "../backendfactory.h"
+#include "../headless.h"
+
+static const int frames = 100;
+// small step so nothing dies during the run and every backend draws every particle
+static const float dt = 1.0f / 1000.0f;
+
+struct FrameTimes
+{
+    double update = 0.0;
+    double render = 0.0;
+};
+
+static double elapsed(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// glFinish after each phase so GPU work is accounted to the phase that queued it
+static FrameTimes runFrames(ParticleBackend &system)
+{
+    FrameTimes times;
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        auto start = std::chrono::steady_clock::now();
+        system.Update(dt, 0, glm::vec3(0.0f));
+        glFinish();
+        times.update += elapsed(start);
+
+        start = std::chrono::steady_clock::now();
+        glClear(GL_COLOR_BUFFER_BIT);
+        system.Render();
+        glFinish();
+        times.render += elapsed(start);
+    }
+    times.update /= frames;
+    times.render /= frames;
+    return times;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<unsigned int> amounts;
+    for (int i = 1; i < argc; ++i)
+        amounts.push_back(strtoul(argv[i], nullptr, 10));
+    if (amounts.empty())
+        amounts = { 10000, 100000, 1000000, 10000000 };
+
+    HeadlessContext context(800, 600);
+    if (!context.create(4, 3, 3, 3))
+        return 1;
+
+    int major, minor;
+    context.getContextVersion(&major, &minor);
+    printf("renderer: %s, OpenGL %d.%d\n", glGetString(GL_RENDERER), major, minor);
+
+    std::vector<ParticleBackendType> backends = { ParticleBackendType::CPU, ParticleBackendType::TRANSFORM_FEEDBACK };
+    if (selectParticleBackend(major, minor) == ParticleBackendType::COMPUTE)
+        backends.push_back(ParticleBackendType::COMPUTE);
+
+    glEnable(GL_BLEND);
+    JobSystem jobSystem;
+
+    printf("%-18s %9s %10s %10s %10s %14s\n", "backend", "particles", "update ms", "render ms", "frame ms", "Mparticles/s");
+    for (unsigned int amount : amounts)
+    {
+        for (ParticleBackendType type : backends)
+        {
+            std::unique_ptr<ParticleBackend> system = createParticleBackend(type, amount, &jobSystem);
+            system->Initialize();
+
+            Shader &shader = system->getShader();
+            shader.useShaderProgram();
+            shader.setUniformMatrix4x4("projection", glm::mat4(1.0f));
+            shader.setUniformMatrix4x4("view", glm::mat4(1.0f));
+            shader.setUniformMatrix4x4("model", glm::mat4(1.0f));
+
+            system->AddParticles(0, glm::vec3(0.0f), glm::vec3(0.0f), 0.0f, amount, glm::vec3(0.0f));
+            FrameTimes times = runFrames(*system);
+            double frame = times.update + times.render;
+            printf("%-18s %9u %10.3f %10.3f %10.3f %14.1f\n", particleBackendName(type), amount,
+                   times.update, times.render, frame, amount / (frame * 1e3));
+
+            glDeleteProgram(shader.getShaderProgram());
+        }
+    }
+
+    glCheckError();
+    return 0;
+}
@@ -0,0 +1,70 @@
+// Compares the ParticleSystem update loop on the old std::vector<Particle>
+// layout against the ParticleStore structure-of-arrays layout.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "../particlestore.h"
+#include "../particlekernels.h"
+
+static const std::size_t particleCount = 1000000;
+static const int iterations = 100;
+static const float dt = 1.0f / 600.0f;
+
+// same loop ParticleSystem::Update ran on std::vector<Particle>
+static void integrateParticlesAoS(std::vector<Particle> &particles, float dt)
+{
+    for (Particle &p : particles)
+    {
+        p.m_life -= dt;
+        if (p.m_life > 0.0f)
+        {
+            p.m_position -= p.m_velocity * dt * 2.f;
+            p.m_color.a -= dt * 1.f;
+        }
+    }
+}
+
+template <typename Function>
+static double measure(Function function)
+{
+    // one warm up pass, then the average over all iterations
+    function();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        function();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+int main()
+{
+    std::vector<Particle> aos(particleCount);
+    ParticleStore soa(particleCount);
+
+    srand(42);
+    for (std::size_t i = 0; i < particleCount; ++i)
+    {
+        glm::vec3 velocity(0.01f * (rand() % 100), 0.01f * (rand() % 100), 0.01f * (rand() % 100));
+        float life = static_cast<float>(rand() % 1000);
+
+        aos[i].m_velocity = velocity;
+        aos[i].m_life = life;
+        soa.setVelocity(i, velocity);
+        soa.m_life[i] = life;
+    }
+
+    double aosTime = measure([&]() { integrateParticlesAoS(aos, dt); });
+    double soaTime = measure([&]() { integrateParticlesScalar(soa, 0, particleCount, dt); });
+
+    printf("particles: %zu, iterations: %d\n", particleCount, iterations);
+    printf("AoS (48 bytes/particle): %8.3f ms/update %6.2f ns/particle\n",
+           aosTime, aosTime * 1e6 / particleCount);
+    printf("SoA (32 bytes touched):  %8.3f ms/update %6.2f ns/particle\n",
+           soaTime, soaTime * 1e6 / particleCount);
+    printf("speedup: %.2fx\n", aosTime / soaTime);
+
+    return 0;
+}
@@ -0,0 +1,250 @@
+// Google Benchmark suite for the GL-free ParticleSimulation hot paths:
+// Update, AddParticles and firstUnusedParticle, from 1k to 10M particles at
+// several pool fill levels. BM_AddParticles against BM_AddParticlesPerParticle
+// is the batched spawn against the old per-particle path, 10k spawns each.
+// BM_DepthSort is the back-to-front DepthSorter, from scratch and from last
+// frame's order, BM_Cull the per-particle frustum cull and its compaction.
+// Runs on machines without a GL context.
+//
+// usage: particle_bench [--benchmark_filter=...] [other benchmark flags]
+//
+// time_per_particle is the wall time per particle touched, bytes/particle
+// the memory traffic per particle of the measured operation.
+
+#include <cmath>
+#include <cstddef>
+
+#include <benchmark/benchmark.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../particlesimulation.h"
+#include "../particlesort.h"
+#include "../particlecull.h"
+
+// small step so fresh particles live for thousands of iterations
+static const float dt = 1.0f / 10000.0f;
+// particles that rain every frame, like the interactive loop
+static const unsigned int rain = 100;
+// spawns measured per iteration of the AddParticles benchmarks
+static const unsigned int spawnBatch = 10000;
+
+// integrate reads position, velocity, alpha and life and writes position,
+// alpha and life back; removeDead reads life once more
+static const std::size_t updateBytesPerParticle = (8 + 5 + 1) * sizeof(float);
+// an interpolated Update first copies position to the previous step
+static const std::size_t interpolatedUpdateBytesPerParticle = updateBytesPerParticle + 6 * sizeof(float);
+// a spawn resets the whole slot, respawnParticle writes velocity and life again
+// keys from the positions, then the keys gathered in last frame's order
+static const std::size_t sortBytesPerParticle = (3 + 1) * sizeof(float) + 3 * sizeof(uint16_t);
+// plus a histogram and a key + index scatter for both bytes
+static const std::size_t radixSortBytesPerParticle = sortBytesPerParticle + 2 * (5 * sizeof(uint16_t) + 2 * sizeof(uint32_t));
+// the cull reads the positions and writes a bit, the compaction an index per
+// visible particle (about two thirds of them in BM_Cull)
+static const std::size_t cullBytesPerParticle = 3 * sizeof(float) + 2 * sizeof(uint32_t) / 3;
+static const std::size_t spawnBytesPerParticle = ParticleStore::bytesPerParticle + 4 * sizeof(float);
+
+static void addParticles(ParticleSimulation &simulation, unsigned int count)
+{
+    simulation.AddParticles(0, glm::vec3(0.0f), glm::vec3(0.0f), 0.0f, count, glm::vec3(0.0f));
+}
+
+static void setCounters(benchmark::State &state, std::size_t particlesPerIteration, std::size_t bytesPerParticle)
+{
+    const double particles = static_cast<double>(particlesPerIteration) * state.iterations();
+    state.SetItemsProcessed(static_cast<int64_t>(particles));
+    state.SetBytesProcessed(static_cast<int64_t>(particles * bytesPerParticle));
+    state.counters["time_per_particle"] = benchmark::Counter(particles, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+    state.counters["bytes/particle"] = static_cast<double>(bytesPerParticle);
+}
+
+// amount particles spread over a 40 unit cube around the origin
+static void spreadParticles(ParticleSimulation &simulation, unsigned int amount)
+{
+    addParticles(simulation, amount);
+    ParticleStore &particles = simulation.getParticles();
+    ParticleRandom random;
+    for (unsigned int i = 0; i < amount; ++i)
+    {
+        float uniforms[4];
+        random.uniform4(0, i, uniforms);
+        particles.setPosition(i, glm::vec3(uniforms[0], uniforms[1], uniforms[2]) * 40.0f - glm::vec3(20.0f));
+    }
+}
+
+// Update on a pool of range(0) particles with range(1) percent of them alive
+static void runUpdate(benchmark::State &state, bool interpolated, bool trackBounds = false)
+{
+    const unsigned int amount = static_cast<unsigned int>(state.range(0));
+    const unsigned int alive = static_cast<unsigned int>(state.range(0) * state.range(1) / 100);
+    ParticleSimulation simulation(amount);
+    simulation.setInterpolated(interpolated);
+    simulation.setTrackBounds(trackBounds);
+    addParticles(simulation, alive);
+
+    std::size_t updated = 0;
+    for (auto _ : state)
+    {
+        updated += simulation.getParticles().aliveCount();
+        simulation.Update(dt, rain, glm::vec3(1.0f, 2.0f, 3.0f));
+        benchmark::DoNotOptimize(simulation.getParticles().m_positionY.data());
+        // keep the fill level when particles run out of life
+        if (simulation.getParticles().aliveCount() < alive)
+        {
+            state.PauseTiming();
+            addParticles(simulation, alive - static_cast<unsigned int>(simulation.getParticles().aliveCount()));
+            state.ResumeTiming();
+        }
+    }
+    setCounters(state, state.iterations() ? updated / state.iterations() : 0,
+                interpolated ? interpolatedUpdateBytesPerParticle : updateBytesPerParticle);
+}
+
+static void BM_Update(benchmark::State &state)
+{
+    runUpdate(state, false);
+}
+
+// Update keeping the previous positions for a fixed timestep's interpolation
+static void BM_UpdateInterpolated(benchmark::State &state)
+{
+    runUpdate(state, true);
+}
+
+// Update keeping the emitter bounds for culling, from the integrated chunks
+static void BM_UpdateBounds(benchmark::State &state)
+{
+    runUpdate(state, false, true);
+}
+
+// spawnBatch particles through AddParticles (one spawnParticles batch) into a
+// pool that is range(1) percent full; once the pool is full (always at 100,
+// after the first 1000 spawns for 1k) the rest lands on the recycled slot 0
+static void BM_AddParticles(benchmark::State &state)
+{
+    const unsigned int amount = static_cast<unsigned int>(state.range(0));
+    const unsigned int alive = static_cast<unsigned int>(state.range(0) * state.range(1) / 100);
+    ParticleSimulation simulation(amount);
+    addParticles(simulation, alive);
+
+    for (auto _ : state)
+    {
+        addParticles(simulation, spawnBatch);
+        benchmark::ClobberMemory();
+        state.PauseTiming();
+        simulation.getParticles().truncate(alive);
+        state.ResumeTiming();
+    }
+    setCounters(state, spawnBatch, spawnBytesPerParticle);
+}
+
+// the per-particle path AddParticles used before spawnParticles:
+// firstUnusedParticle + respawnParticle for every particle
+static void BM_AddParticlesPerParticle(benchmark::State &state)
+{
+    const unsigned int amount = static_cast<unsigned int>(state.range(0));
+    const unsigned int alive = static_cast<unsigned int>(state.range(0) * state.range(1) / 100);
+    ParticleSimulation simulation(amount);
+    addParticles(simulation, alive);
+
+    for (auto _ : state)
+    {
+        for (unsigned int i = 0; i < spawnBatch; ++i)
+        {
+            unsigned int index = simulation.firstUnusedParticle();
+            simulation.respawnParticle(index, 0, glm::vec3(0.0f), glm::vec3(0.0f), 0.0f, glm::vec3(0.0f));
+        }
+        benchmark::ClobberMemory();
+        state.PauseTiming();
+        simulation.getParticles().truncate(alive);
+        state.ResumeTiming();
+    }
+    setCounters(state, spawnBatch, spawnBytesPerParticle);
+}
+
+// firstUnusedParticle alone, spawnBatch calls per iteration
+static void BM_FirstUnusedParticle(benchmark::State &state)
+{
+    const unsigned int amount = static_cast<unsigned int>(state.range(0));
+    const unsigned int alive = static_cast<unsigned int>(state.range(0) * state.range(1) / 100);
+    ParticleSimulation simulation(amount);
+    addParticles(simulation, alive);
+
+    for (auto _ : state)
+    {
+        for (unsigned int i = 0; i < spawnBatch; ++i)
+            benchmark::DoNotOptimize(simulation.firstUnusedParticle());
+        state.PauseTiming();
+        simulation.getParticles().truncate(alive);
+        state.ResumeTiming();
+    }
+    setCounters(state, spawnBatch, ParticleStore::bytesPerParticle);
+}
+
+// DepthSorter on range(0) particles spread over a 40 unit cube, one
+// simulation step between sorts; range(1) 0 forgets the previous order every
+// frame (a full radix sort), 1 keeps it like the renderer does
+static void BM_DepthSort(benchmark::State &state)
+{
+    const unsigned int amount = static_cast<unsigned int>(state.range(0));
+    const bool coherent = state.range(1) != 0;
+    ParticleSimulation simulation(amount);
+    spreadParticles(simulation, amount);
+
+    DepthSorter sorter;
+    const glm::vec3 eye(0.0f, 0.0f, 30.0f);
+    const glm::vec3 front(0.0f, 0.0f, -1.0f);
+    std::size_t sorted = 0;
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        simulation.Update(dt, rain, glm::vec3(1.0f, 2.0f, 3.0f));
+        if (!coherent)
+            sorter.reset();
+        const ParticleView view = simulation.getAliveParticles();
+        sorted += view.size();
+        state.ResumeTiming();
+        benchmark::DoNotOptimize(sorter.sort(view, 1.0f, eye, front).data());
+    }
+    setCounters(state, state.iterations() ? sorted / state.iterations() : 0,
+                coherent ? sortBytesPerParticle : radixSortBytesPerParticle);
+}
+
+// ParticleCuller on range(0) particles spread over a 40 unit cube, seen from
+// 30 units away so about two thirds of them are visible; range(1) 1 culls
+// in back to front order, like the renderer with depth sorting on
+static void BM_Cull(benchmark::State &state)
+{
+    const unsigned int amount = static_cast<unsigned int>(state.range(0));
+    const bool sorted = state.range(1) != 0;
+    ParticleSimulation simulation(amount);
+    spreadParticles(simulation, amount);
+    simulation.Update(dt, rain, glm::vec3(1.0f, 2.0f, 3.0f));
+
+    const glm::vec3 eye(0.0f, 0.0f, 30.0f);
+    const glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+    const Frustum frustum = Frustum::fromMatrix(projection * glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+    const ParticleView view = simulation.getAliveParticles();
+    DepthSorter sorter;
+    const uint32_t *order = sorted ? sorter.sort(view, 1.0f, eye, glm::vec3(0.0f, 0.0f, -1.0f)).data() : nullptr;
+    ParticleCuller culler;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(culler.cull(view, 1.0f, frustum, 2.83f, order).data());
+    state.counters["visible%"] = 100.0 * culler.getIndices().size() / view.size();
+    setCounters(state, view.size(), cullBytesPerParticle);
+}
+
+static const std::vector<int64_t> particleCounts = { 1000, 10000, 100000, 1000000, 10000000 };
+static const std::vector<int64_t> fillPercents = { 0, 50, 90, 100 };
+
+BENCHMARK(BM_Update)->ArgsProduct({ particleCounts, fillPercents })->ArgNames({ "particles", "fill%" })->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_UpdateInterpolated)->ArgsProduct({ particleCounts, fillPercents })->ArgNames({ "particles", "fill%" })->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_UpdateBounds)->ArgsProduct({ particleCounts, fillPercents })->ArgNames({ "particles", "fill%" })->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_AddParticles)->ArgsProduct({ particleCounts, fillPercents })->ArgNames({ "particles", "fill%" })->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_AddParticlesPerParticle)->ArgsProduct({ particleCounts, fillPercents })->ArgNames({ "particles", "fill%" })->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_FirstUnusedParticle)->ArgsProduct({ particleCounts, fillPercents })->ArgNames({ "particles", "fill%" })->Unit(benchmark::kMicrosecond);
+
+BENCHMARK(BM_DepthSort)->ArgsProduct({ { 10000, 100000, 1000000 }, { 0, 1 } })->ArgNames({ "particles", "coherent" })->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_Cull)->ArgsProduct({ { 10000, 100000, 1000000 }, { 0, 1 } })->ArgNames({ "particles", "sorted" })->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
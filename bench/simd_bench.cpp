@@ -0,0 +1,162 @@
+// Times every update kernel the CPU supports over 1M particles and checks
+// its output against the scalar kernel, then does the same for the Philox
+// uniform fill and the frustum cull, which have to match bit for bit.
+// Returns non-zero on a mismatch.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "../particlestore.h"
+#include "../particlekernels.h"
+#include "../particlerandom.h"
+#include "../particlecull.h"
+
+static const std::size_t particleCount = 1000000;
+static const int iterations = 100;
+static const float dt = 1.0f / 60.0f;
+static const float tolerance = 1e-5f;
+
+static void fillStore(ParticleStore &store)
+{
+    srand(42);
+    for (std::size_t i = 0; i < store.size(); ++i)
+    {
+        store.setPosition(i, glm::vec3(rand() % 100, rand() % 100, rand() % 100));
+        store.setVelocity(i, glm::vec3(0.01f * (rand() % 100), 0.01f * (rand() % 100), 0.01f * (rand() % 100)));
+        store.m_colorA[i] = 1.0f;
+        // mix of dead, dying and long lived particles so both mask lanes are hit
+        store.m_life[i] = 0.01f * (rand() % 300) - 0.5f;
+    }
+}
+
+static float maxDifference(const AlignedVector<float> &a, const AlignedVector<float> &b)
+{
+    float difference = 0.0f;
+    for (std::size_t i = 0; i < a.size(); ++i)
+        difference = std::fmax(difference, std::fabs(a[i] - b[i]));
+    return difference;
+}
+
+static float maxDifference(const ParticleStore &a, const ParticleStore &b)
+{
+    float difference = maxDifference(a.m_life, b.m_life);
+    difference = std::fmax(difference, maxDifference(a.m_positionX, b.m_positionX));
+    difference = std::fmax(difference, maxDifference(a.m_positionY, b.m_positionY));
+    difference = std::fmax(difference, maxDifference(a.m_positionZ, b.m_positionZ));
+    difference = std::fmax(difference, maxDifference(a.m_colorA, b.m_colorA));
+    return difference;
+}
+
+int main()
+{
+    std::vector<SimdPath> paths = { SimdPath::SCALAR };
+#if defined(PARTICLE_SIMD_X86)
+    paths.push_back(SimdPath::SSE);
+    if (detectSimdPath() == SimdPath::AVX2)
+        paths.push_back(SimdPath::AVX2);
+#elif defined(PARTICLE_SIMD_NEON)
+    paths.push_back(SimdPath::NEON);
+#endif
+
+    ParticleStore reference(particleCount);
+    fillStore(reference);
+    // a handful of steps so particles die part way through
+    for (int step = 0; step < 10; ++step)
+        integrateParticlesScalar(reference, 0, particleCount, dt);
+
+    printf("particles: %zu, iterations: %d, runtime path: %s\n",
+           particleCount, iterations, simdPathName(detectSimdPath()));
+
+    bool passed = true;
+    for (SimdPath path : paths)
+    {
+        IntegrateParticlesFunction function = getIntegrateParticles(path);
+
+        ParticleStore store(particleCount);
+        fillStore(store);
+        for (int step = 0; step < 10; ++step)
+            function(store, 0, particleCount, dt);
+        float difference = maxDifference(reference, store);
+        bool matches = difference <= tolerance;
+        passed = passed && matches;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+            function(store, 0, particleCount, dt);
+        auto end = std::chrono::steady_clock::now();
+        double time = std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+
+        printf("%-6s %8.3f ms/update %6.2f ns/particle  max diff %g %s\n",
+               simdPathName(path), time, time * 1e6 / particleCount,
+               difference, matches ? "ok" : "MISMATCH");
+    }
+
+    // the Philox fill, with an offset that doesn't start on a block
+    const uint64_t seed = 42, stream = 7, first = 3;
+    std::vector<float> referenceRandom(particleCount);
+    philox::fillBlocksScalar(referenceRandom.data(), particleCount / 4, seed, stream, first);
+    for (SimdPath path : paths)
+    {
+        philox::FillBlocksFunction function = philox::getFillBlocks(path);
+        std::vector<float> random(particleCount);
+        function(random.data(), particleCount / 4, seed, stream, first);
+        bool matches = memcmp(random.data(), referenceRandom.data(), particleCount / 4 * 4 * sizeof(float)) == 0;
+        passed = passed && matches;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+            function(random.data(), particleCount / 4, seed, stream + i, first);
+        auto end = std::chrono::steady_clock::now();
+        double time = std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+
+        printf("%-6s %8.3f ms/fill   %6.2f ns/float     %s\n",
+               simdPathName(path), time, time * 1e6 / particleCount, matches ? "bit exact" : "MISMATCH");
+    }
+
+    // the frustum cull of the store as it is after the updates, interpolated
+    // half way back to where it started, seen from outside the 100 unit cube
+    ParticleStore previous(particleCount);
+    fillStore(previous);
+    auto all = [](const AlignedVector<float> &array) { return std::span<const float>(array.data(), array.size()); };
+    ParticleView view;
+    view.positionX = all(reference.m_positionX);
+    view.positionY = all(reference.m_positionY);
+    view.positionZ = all(reference.m_positionZ);
+    view.previousX = all(previous.m_positionX);
+    view.previousY = all(previous.m_positionY);
+    view.previousZ = all(previous.m_positionZ);
+    const glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+    const glm::mat4 camera = glm::lookAt(glm::vec3(50.0f, 50.0f, 120.0f), glm::vec3(50.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    const Frustum frustum = Frustum::fromMatrix(projection * camera);
+    const float radius = 2.83f, alpha = 0.5f;
+    std::vector<uint8_t> referenceVisible(particleCount / 8);
+    cullParticlesScalar(view, alpha, frustum, radius, referenceVisible.data(), 0, particleCount);
+    std::size_t visibleCount = 0;
+    for (uint8_t bits : referenceVisible)
+        visibleCount += __builtin_popcount(bits);
+    for (SimdPath path : paths)
+    {
+        CullParticlesFunction function = getCullParticles(path);
+        std::vector<uint8_t> visible(particleCount / 8);
+        function(view, alpha, frustum, radius, visible.data(), 0, particleCount);
+        bool matches = visible == referenceVisible;
+        passed = passed && matches;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+            function(view, alpha, frustum, radius, visible.data(), 0, particleCount);
+        auto end = std::chrono::steady_clock::now();
+        double time = std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+
+        printf("%-6s %8.3f ms/cull   %6.2f ns/particle  %zu visible %s\n",
+               simdPathName(path), time, time * 1e6 / particleCount, visibleCount, matches ? "bit exact" : "MISMATCH");
+    }
+
+    return passed ? 0 : 1;
+}
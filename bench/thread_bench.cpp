@@ -0,0 +1,64 @@
+// Particle update throughput on the JobSystem as a function of thread count,
+// from 1 to all hardware threads.
+//
+// usage: thread_bench [particles] [grain size]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#include "../particlestore.h"
+#include "../particlekernels.h"
+#include "../jobsystem.h"
+
+static const int iterations = 50;
+static const float dt = 1.0f / 600.0f;
+
+int main(int argc, char **argv)
+{
+    std::size_t particleCount = argc > 1 ? strtoull(argv[1], nullptr, 10) : 4000000;
+    std::size_t grain = argc > 2 ? strtoull(argv[2], nullptr, 10) : 16384;
+    grain = (grain + ParticleStore::cacheLineFloats - 1) / ParticleStore::cacheLineFloats * ParticleStore::cacheLineFloats;
+
+    ParticleStore store(particleCount);
+    srand(42);
+    for (std::size_t i = 0; i < particleCount; ++i)
+    {
+        store.setVelocity(i, glm::vec3(0.01f * (rand() % 100), 0.01f * (rand() % 100), 0.01f * (rand() % 100)));
+        store.m_life[i] = static_cast<float>(rand() % 1000);
+    }
+
+    unsigned int maxThreads = std::thread::hardware_concurrency();
+    if (maxThreads == 0)
+        maxThreads = 1;
+
+    printf("particles: %zu, grain: %zu, kernel: %s\n",
+           particleCount, grain, simdPathName(detectSimdPath()));
+    printf("threads  ms/update  Mparticles/s  speedup\n");
+
+    double singleThreaded = 0.0;
+    for (unsigned int threads = 1; threads <= maxThreads; ++threads)
+    {
+        JobSystem jobSystem(threads);
+        auto update = [&]() {
+            jobSystem.parallelFor(0, particleCount, grain, [&](std::size_t begin, std::size_t end) {
+                integrateParticles(store, begin, end, dt);
+            });
+        };
+
+        update();
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+            update();
+        auto end = std::chrono::steady_clock::now();
+        double time = std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+        if (threads == 1)
+            singleThreaded = time;
+
+        printf("%7u  %9.3f  %12.1f  %6.2fx\n",
+               threads, time, particleCount / (time * 1e3), singleThreaded / time);
+    }
+
+    return 0;
+}
@@ -0,0 +1,393 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "3rdparty/stb_image.h"
+#include "backendfactory.h"
+#include "compressedtexture.h"
+#include "headless.h"
+#include "mipchain.h"
+
+// Fixed scenario for Particlesystem --bench: a headless context, one backend
+// filled with particles and stepped with a constant dt, so runs on different
+// machines and commits are comparable.
+struct BenchSettings
+{
+    unsigned int frames = 600;
+    unsigned int particles = 100000;
+    // particles that rain every frame, like the interactive loop
+    unsigned int rain = 100;
+    float dt = 1.0f / 60.0f;
+    int width = 800;
+    int height = 600;
+    // .json writes JSON, anything else CSV; empty prints the summary only
+    std::string output;
+    // otherwise the backend selectParticleBackend picks for the context
+    bool forceBackend = false;
+    ParticleBackendType backend = ParticleBackendType::CPU;
+    // simulate on a SimulationThread, the update phase then only queues the step
+    bool async = false;
+    // back to front sort from the bench camera, for the alpha blend mode
+    bool depthSort = false;
+    ParticleBlendMode blendMode = ParticleBlendMode::ADDITIVE;
+    // frustum culling from the bench camera, most of the rain falls outside it
+    ParticleCulling culling = ParticleCulling::NONE;
+    // sprite the particles sample: a PNG uploaded as RGBA8 or a KTX of
+    // sprite_encoder, to compare texture memory and traffic; empty binds none
+    std::string sprite;
+};
+
+// milliseconds of every phase of one frame
+struct BenchFrame
+{
+    double update = 0.0;
+    double upload = 0.0;
+    double render = 0.0;
+    // particles Upload left for Render, and the ones culling left out
+    std::size_t drawn = 0;
+    std::size_t culled = 0;
+    // fragments Render shaded, counted with a GL_SAMPLES_PASSED query
+    std::size_t fragments = 0;
+};
+
+struct BenchPercentiles
+{
+    double p50 = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+};
+
+// nearest rank percentiles
+inline BenchPercentiles benchPercentiles(std::vector<double> samples)
+{
+    BenchPercentiles result;
+    if (samples.empty())
+        return result;
+    std::sort(samples.begin(), samples.end());
+    auto rank = [&samples](double percentile) {
+        size_t index = static_cast<size_t>(percentile * samples.size() + 0.5);
+        return samples[std::min(index > 0 ? index - 1 : 0, samples.size() - 1)];
+    };
+    result.p50 = rank(0.50);
+    result.p95 = rank(0.95);
+    result.p99 = rank(0.99);
+    return result;
+}
+
+class BenchRunner
+{
+public:
+
+    BenchRunner(const BenchSettings &settings) : m_settings(settings) {}
+
+    int run()
+    {
+        HeadlessContext context(m_settings.width, m_settings.height);
+        if (!context.create(4, 3, 3, 3))
+            return 1;
+
+        int major, minor;
+        context.getContextVersion(&major, &minor);
+        ParticleBackendType type = m_settings.forceBackend ? m_settings.backend : selectParticleBackend(major, minor);
+        if (type == ParticleBackendType::COMPUTE && selectParticleBackend(major, minor) != ParticleBackendType::COMPUTE)
+        {
+            std::cerr << "[WARN] Compute backend needs OpenGL 4.3, got " << major << "." << minor << std::endl;
+            return 1;
+        }
+        const GLubyte *renderer = glGetString(GL_RENDERER);
+        m_renderer = renderer ? reinterpret_cast<const char*>(renderer) : "unknown";
+        m_backend = particleBackendName(type);
+        std::cerr << "bench: " << m_renderer << ", OpenGL " << major << "." << minor << ", backend " << m_backend
+                  << (m_settings.async ? " (async)" : "") << (m_settings.depthSort ? " (sorted)" : "")
+                  << (m_settings.culling != ParticleCulling::NONE ? " (culled)" : "") << ", " << m_settings.particles << " particles, "
+                  << m_settings.frames << " frames" << std::endl;
+
+        JobSystem jobSystem;
+        std::unique_ptr<ParticleBackend> system = createParticleBackend(type, m_settings.particles, &jobSystem);
+        system->Initialize();
+
+        Shader &shader = system->getShader();
+        shader.useShaderProgram();
+        shader.setUniformInt("sprite", 0);
+        float aspect = static_cast<float>(m_settings.width) / static_cast<float>(m_settings.height);
+        const glm::mat4 projection = glm::perspective(glm::radians(45.0f), aspect, 0.1f, 100.0f);
+        shader.setUniformMatrix4x4("projection", projection);
+        const glm::vec3 eye(0.0f, 0.0f, 10.0f);
+        const glm::mat4 view = glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        shader.setUniformMatrix4x4("view", view);
+        shader.setUniformMatrix4x4("model", glm::mat4(1.0f));
+
+        GLuint sprite = 0;
+        if (!m_settings.sprite.empty() && (sprite = loadSprite()) == 0)
+            return 1;
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, sprite);
+        GLuint fragmentQuery;
+        glGenQueries(1, &fragmentQuery);
+
+        glEnable(GL_BLEND);
+        system->AddParticles(0, glm::vec3(0.0f), glm::vec3(0.0f), 0.0f, m_settings.particles, glm::vec3(0.0f));
+        glFinish();
+        system->setAsyncSimulation(m_settings.async);
+        system->setBlendMode(m_settings.blendMode);
+        system->setDepthSort(m_settings.depthSort);
+        system->setViewer(eye, glm::normalize(-eye));
+        system->setCulling(m_settings.culling);
+        system->setFrustum(projection * view);
+
+        // glFinish after each phase so GPU work is accounted to the phase that queued it
+        m_frames.assign(m_settings.frames, BenchFrame());
+        for (BenchFrame &frame : m_frames)
+        {
+            auto start = std::chrono::steady_clock::now();
+            system->Simulate(m_settings.dt, m_settings.rain, glm::vec3(1.0f, 2.0f, 3.0f));
+            glFinish();
+            frame.update = elapsed(start);
+
+            start = std::chrono::steady_clock::now();
+            system->Upload();
+            glFinish();
+            frame.upload = elapsed(start);
+            frame.drawn = system->getDrawnParticles();
+            frame.culled = system->getCulledParticles();
+
+            start = std::chrono::steady_clock::now();
+            glClearColor(0.2f, 0.5f, 0.7f, 0.6f);
+            glClear(GL_COLOR_BUFFER_BIT);
+            shader.useShaderProgram();
+            glBeginQuery(GL_SAMPLES_PASSED, fragmentQuery);
+            system->Render();
+            glEndQuery(GL_SAMPLES_PASSED);
+            glFinish();
+            frame.render = elapsed(start);
+
+            GLuint fragments = 0;
+            glGetQueryObjectuiv(fragmentQuery, GL_QUERY_RESULT, &fragments);
+            frame.fragments = fragments;
+        }
+        system->setAsyncSimulation(false);
+        glDeleteQueries(1, &fragmentQuery);
+        glDeleteTextures(1, &sprite);
+        glDeleteProgram(shader.getShaderProgram());
+
+        printSummary();
+        if (!m_settings.output.empty() && !writeOutput())
+            return 1;
+        return 0;
+    }
+
+private:
+
+    // texture of --bench-sprite, its size and the bytes a texel fetch reads
+    GLuint loadSprite()
+    {
+        const std::string &path = m_settings.sprite;
+        if (path.size() >= 4 && path.compare(path.size() - 4, 4, ".ktx") == 0)
+        {
+            CompressedTextureInfo info;
+            const GLuint texture = loadCompressedTexture(path, &info);
+            m_spriteFormat = blockFormatName(info.format);
+            m_spriteBytes = info.bytes;
+            m_spriteBytesPerTexel = info.bytesPerTexel();
+            return texture;
+        }
+
+        int width, height, channels;
+        unsigned char *pixels = stbi_load(path.c_str(), &width, &height, &channels, 4);
+        if (!pixels)
+        {
+            std::cerr << "Failed to load texture: " << path << std::endl;
+            return 0;
+        }
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        stbi_image_free(pixels);
+        std::vector<MipLevel> levels;
+        m_spriteFormat = "RGBA8";
+        m_spriteBytes = mipChainLevels(width, height, 4, levels);
+        m_spriteBytesPerTexel = 4.0;
+        return texture;
+    }
+
+    // text as the contents of a JSON string, the renderer name is the driver's
+    static std::string jsonEscape(const std::string &text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                escaped += '\\';
+                escaped += c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char code[8];
+                snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned char>(c));
+                escaped += code;
+            }
+            else
+            {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    static double elapsed(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    BenchPercentiles phasePercentiles(double BenchFrame::*phase) const
+    {
+        std::vector<double> samples;
+        samples.reserve(m_frames.size());
+        for (const BenchFrame &frame : m_frames)
+            samples.push_back(phase ? frame.*phase : frame.update + frame.upload + frame.render);
+        return benchPercentiles(samples);
+    }
+
+    // the three phases plus the whole frame (null member)
+    struct Phase
+    {
+        const char *name;
+        double BenchFrame::*member;
+    };
+    static constexpr Phase phases[] = {
+        { "update", &BenchFrame::update },
+        { "upload", &BenchFrame::upload },
+        { "render", &BenchFrame::render },
+        { "frame", nullptr }
+    };
+
+    void printSummary() const
+    {
+        printf("%-8s %10s %10s %10s\n", "phase", "p50 ms", "p95 ms", "p99 ms");
+        for (const Phase &phase : phases)
+        {
+            BenchPercentiles p = phasePercentiles(phase.member);
+            printf("%-8s %10.3f %10.3f %10.3f\n", phase.name, p.p50, p.p95, p.p99);
+        }
+        if (m_settings.culling != ParticleCulling::NONE)
+        {
+            double drawn, culled;
+            cullAverages(&drawn, &culled);
+            printf("culling %s: %.0f particles drawn, %.0f culled per frame\n",
+                   particleCullingName(m_settings.culling), drawn, culled);
+        }
+        if (!m_settings.sprite.empty())
+        {
+            // every fragment pulls about one new texel from memory at its mip level
+            double fragments = 0.0;
+            for (const BenchFrame &frame : m_frames)
+                fragments += frame.fragments;
+            fragments /= std::max<std::size_t>(m_frames.size(), 1);
+            printf("sprite %s: %s, %.1f KiB with mips, %.0f fragments per frame, ~%.2f MiB texel traffic per frame\n",
+                   m_settings.sprite.c_str(), m_spriteFormat.c_str(), m_spriteBytes / 1024.0, fragments,
+                   fragments * m_spriteBytesPerTexel / (1024.0 * 1024.0));
+        }
+    }
+
+    void cullAverages(double *drawn, double *culled) const
+    {
+        *drawn = 0.0;
+        *culled = 0.0;
+        for (const BenchFrame &frame : m_frames)
+        {
+            *drawn += frame.drawn;
+            *culled += frame.culled;
+        }
+        if (!m_frames.empty())
+        {
+            *drawn /= m_frames.size();
+            *culled /= m_frames.size();
+        }
+    }
+
+    bool writeOutput() const
+    {
+        FILE *file = fopen(m_settings.output.c_str(), "w");
+        if (!file)
+        {
+            std::cerr << "[WARN] Failed open " << m_settings.output << std::endl;
+            return false;
+        }
+        const std::string &path = m_settings.output;
+        if (path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0)
+            writeJson(file);
+        else
+            writeCsv(file);
+        fclose(file);
+        std::cerr << "bench: wrote " << path << std::endl;
+        return true;
+    }
+
+    // one row per frame, the percentiles follow as rows named p50/p95/p99
+    void writeCsv(FILE *file) const
+    {
+        fprintf(file, "frame,update_ms,upload_ms,render_ms,frame_ms,drawn,culled\n");
+        for (size_t i = 0; i < m_frames.size(); ++i)
+        {
+            const BenchFrame &f = m_frames[i];
+            fprintf(file, "%zu,%.6f,%.6f,%.6f,%.6f,%zu,%zu\n", i, f.update, f.upload, f.render, f.update + f.upload + f.render,
+                    f.drawn, f.culled);
+        }
+        BenchPercentiles p[4];
+        for (int i = 0; i < 4; ++i)
+            p[i] = phasePercentiles(phases[i].member);
+        fprintf(file, "p50,%.6f,%.6f,%.6f,%.6f,,\n", p[0].p50, p[1].p50, p[2].p50, p[3].p50);
+        fprintf(file, "p95,%.6f,%.6f,%.6f,%.6f,,\n", p[0].p95, p[1].p95, p[2].p95, p[3].p95);
+        fprintf(file, "p99,%.6f,%.6f,%.6f,%.6f,,\n", p[0].p99, p[1].p99, p[2].p99, p[3].p99);
+    }
+
+    void writeJson(FILE *file) const
+    {
+        fprintf(file, "{\n  \"renderer\": \"%s\",\n  \"backend\": \"%s\",\n", jsonEscape(m_renderer).c_str(),
+                m_backend.c_str());
+        fprintf(file, "  \"particles\": %u,\n  \"frames\": %u,\n  \"dt\": %.9g,\n  \"async\": %s,\n  \"sorted\": %s,\n",
+                m_settings.particles, m_settings.frames, m_settings.dt, m_settings.async ? "true" : "false",
+                m_settings.depthSort ? "true" : "false");
+        double drawn, culled;
+        cullAverages(&drawn, &culled);
+        fprintf(file, "  \"culling\": \"%s\",\n  \"drawn_avg\": %.1f,\n  \"culled_avg\": %.1f,\n",
+                particleCullingName(m_settings.culling), drawn, culled);
+        fprintf(file, "  \"summary\": {\n");
+        for (int i = 0; i < 4; ++i)
+        {
+            BenchPercentiles p = phasePercentiles(phases[i].member);
+            fprintf(file, "    \"%s_ms\": { \"p50\": %.6f, \"p95\": %.6f, \"p99\": %.6f }%s\n",
+                    phases[i].name, p.p50, p.p95, p.p99, i < 3 ? "," : "");
+        }
+        fprintf(file, "  },\n  \"per_frame\": [\n");
+        for (size_t i = 0; i < m_frames.size(); ++i)
+        {
+            const BenchFrame &f = m_frames[i];
+            fprintf(file, "    { \"update_ms\": %.6f, \"upload_ms\": %.6f, \"render_ms\": %.6f, \"drawn\": %zu, \"culled\": %zu }%s\n",
+                    f.update, f.upload, f.render, f.drawn, f.culled, i + 1 < m_frames.size() ? "," : "");
+        }
+        fprintf(file, "  ]\n}\n");
+    }
+
+    BenchSettings m_settings;
+    std::vector<BenchFrame> m_frames;
+    std::string m_renderer;
+    std::string m_backend;
+    std::string m_spriteFormat;
+    std::size_t m_spriteBytes = 0;
+    double m_spriteBytesPerTexel = 0.0;
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <unistd.h>
+
+// 64 bit FNV-1a, chained through hash to cover several buffers
+inline uint64_t hashBytes(const void *data, std::size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    const unsigned char *bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// whole file into memory, false if it can't be read
+inline bool readFile(const std::string &path, std::vector<unsigned char> &bytes)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+        return false;
+    bytes.resize(static_cast<std::size_t>(file.tellg()));
+    file.seekg(0);
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size())));
+}
+
+// write size bytes to path through a temporary and a rename, so a crash or
+// a second instance never leaves a torn file behind; creates the directory
+inline bool writeFileAtomic(const std::string &path, const void *data, std::size_t size)
+{
+    std::error_code error;
+    const std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    if (!parent.empty())
+        std::filesystem::create_directories(parent, error);
+    const std::string temporary = path + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size)))
+        {
+            file.close();
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+    }
+    std::filesystem::rename(temporary, path, error);
+    if (error)
+    {
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
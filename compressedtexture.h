@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+#include "binaryfile.h"
+#include "texturecompress.h"
+
+// what a compressed texture costs against the same mip chain in RGBA8
+struct CompressedTextureInfo
+{
+    BlockFormat format = BlockFormat::BC7;
+    int width = 0, height = 0;
+    std::size_t bytes = 0;
+    std::size_t rgbaBytes = 0;
+
+    // bytes the sampler reads per texel, the bandwidth a fetch costs
+    double bytesPerTexel() const { return blockBytes(format) / 16.0; }
+};
+
+// RGTC is core since 3.0, BPTC since 4.2 or with ARB_texture_compression_bptc
+inline bool compressedFormatSupported(BlockFormat format)
+{
+    if (format != BlockFormat::BC7)
+        return true;
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    if (major > 4 || (major == 4 && minor >= 2))
+        return true;
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i)
+    {
+        const char *extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i)));
+        if (extension && std::strcmp(extension, "GL_ARB_texture_compression_bptc") == 0)
+            return true;
+    }
+    return false;
+}
+
+// create a texture from a KTX file of sprite_encoder, every level uploaded as
+// is with glCompressedTexImage2D. A BC7 file on a context without BPTC loads
+// its RGTC companion (rgtcFallbackPath) instead, gray but still compressed.
+// Returns 0 if neither can be read, the caller falls back to the PNG.
+inline GLuint loadCompressedTexture(const std::string &path, CompressedTextureInfo *info = nullptr)
+{
+    std::vector<unsigned char> file;
+    KtxImage image;
+    if (!readFile(path, file) || !readKtx(file, image))
+    {
+        std::cerr << "Failed to load texture: " << path << std::endl;
+        return 0;
+    }
+    BlockFormat format = static_cast<BlockFormat>(image.internalFormat);
+    if (!compressedFormatSupported(format))
+    {
+        const std::string fallback = rgtcFallbackPath(path);
+        std::cerr << "[WARN] " << blockFormatName(format) << " textures aren't supported by this context, loading "
+                  << fallback << std::endl;
+        if (!readFile(fallback, file) || !readKtx(file, image) ||
+            !compressedFormatSupported(static_cast<BlockFormat>(image.internalFormat)))
+        {
+            std::cerr << "Failed to load texture: " << fallback << std::endl;
+            return 0;
+        }
+        format = static_cast<BlockFormat>(image.internalFormat);
+    }
+
+    GLint bound = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    for (std::size_t i = 0; i < image.levels.size(); ++i)
+    {
+        const MipLevel &level = image.levels[i];
+        glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(i), image.internalFormat, level.width, level.height, 0,
+                               static_cast<GLsizei>(compressedLevelSize(format, level.width, level.height)),
+                               image.data.data() + level.offset);
+    }
+    // one and two channel formats are expanded to RGBA by the swizzle
+    GLint swizzle[4];
+    for (int c = 0; c < 4; ++c)
+    {
+        const char source = image.swizzle[c];
+        swizzle[c] = source == 'r' ? GL_RED : source == 'g' ? GL_GREEN : source == 'b' ? GL_BLUE : source == 'a' ? GL_ALPHA
+                   : source == '0' ? GL_ZERO : GL_ONE;
+    }
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(image.levels.size()) - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, image.levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(bound));
+
+    if (info)
+    {
+        info->format = format;
+        info->width = image.width;
+        info->height = image.height;
+        info->bytes = image.data.size();
+        info->rgbaBytes = 0;
+        for (const MipLevel &level : image.levels)
+            info->rgbaBytes += static_cast<std::size_t>(level.width) * level.height * 4;
+    }
+    return texture;
+}
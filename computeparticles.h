@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+#include <GL/glew.h>
+
+#include "shaders.hpp"
+#include "particlebackend.h"
+
+// particle record in the SSBO, std430 layout of the Particle struct in
+// shaderComputeUpdate / shaderComputeEmit
+struct ComputeParticle {
+    glm::vec4 m_positionLife;
+    glm::vec4 m_velocity;
+    glm::vec4 m_color;
+};
+
+// Compute shader particle system, needs a GL 4.3 context. Particles live in
+// one SSBO that shaderComputeUpdate integrates in place; AddParticles is a
+// dispatch of shaderComputeEmit that appends particles through an atomic
+// counter, so spawning uploads nothing but the counter's start. Render reads
+// the same buffer as instanced vertex attributes with shaderFeedbackRender.
+class ComputeParticleSystem : public ParticleBackend
+{
+public:
+
+    ComputeParticleSystem(Shader shader, uint32_t amount) :
+        m_amount(amount), m_shader(shader) {}
+
+    ~ComputeParticleSystem()
+    {
+        glDeleteVertexArrays(1, &m_VAO);
+        glDeleteBuffers(1, &m_particleSSBO);
+        glDeleteBuffers(1, &m_counterBuffer);
+        glDeleteBuffers(1, &m_quadVBO);
+        glDeleteProgram(m_updateShader.getShaderProgram());
+        glDeleteProgram(m_emitShader.getShaderProgram());
+    }
+
+    void Initialize() override
+    {
+        m_updateShader.loadShader(shaderComputeUpdate, TypeShader::COMPUTE_SHADER);
+        m_updateShader.createShaderProgram();
+        m_emitShader.loadShader(shaderComputeEmit, TypeShader::COMPUTE_SHADER);
+        m_emitShader.createShaderProgram();
+
+        float particle_quad[] = {
+            0.0f, 1.0f, 0.0f, 1.0f,
+            1.0f, 0.0f, 1.0f, 0.0f,
+            0.0f, 0.0f, 0.0f, 0.0f,
+
+            0.0f, 1.0f, 0.0f, 1.0f,
+            1.0f, 1.0f, 1.0f, 1.0f,
+            1.0f, 0.0f, 1.0f, 0.0f
+        };
+        glGenBuffers(1, &m_quadVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, m_quadVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(particle_quad), particle_quad, GL_STATIC_DRAW);
+
+        // the pool starts out with dead default particles
+        std::vector<ComputeParticle> particles(m_amount, ComputeParticle{glm::vec4(0.0f), glm::vec4(0.0f), glm::vec4(1.0f)});
+        glGenBuffers(1, &m_particleSSBO);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_particleSSBO);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, m_amount * sizeof(ComputeParticle), particles.data(), GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        GLuint zero = 0;
+        glGenBuffers(1, &m_counterBuffer);
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, m_counterBuffer);
+        glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(GLuint), &zero, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+
+        // quad at location 0, particle position/color/life per instance like shaderFeedbackRender expects
+        const GLsizei stride = sizeof(ComputeParticle);
+        glGenVertexArrays(1, &m_VAO);
+        glBindVertexArray(m_VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, m_quadVBO);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
+        glBindBuffer(GL_ARRAY_BUFFER, m_particleSSBO);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(ComputeParticle, m_positionLife));
+        glVertexAttribDivisor(1, 1);
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(ComputeParticle, m_color));
+        glVertexAttribDivisor(2, 1);
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, stride, (void*)(offsetof(ComputeParticle, m_positionLife) + 3 * sizeof(float)));
+        glVertexAttribDivisor(3, 1);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // the first newParticles slots rain down like in ParticleSystem::Update
+    void Simulate(float dt, unsigned int newParticles, glm::vec3 offset) override
+    {
+        m_updateShader.useShaderProgram();
+        m_updateShader.setUniformFloat("dt", dt);
+        m_updateShader.setUniformUint("amount", m_amount);
+        m_updateShader.setUniformUint("rainCount", newParticles);
+        m_updateShader.setUniformUint("frame", m_frame++);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_particleSSBO);
+        glDispatchCompute((m_amount + updateGroupSize - 1) / updateGroupSize, 1, 1);
+        // the next dispatch and the instanced draw read what this one wrote
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+    }
+
+    // same spawn rules as ParticleSystem::AddParticles / respawnParticle
+    void AddParticles(short int type, glm::vec3 position, glm::vec3 velocity, float rotation, unsigned int newParticles, glm::vec3 offset) override
+    {
+        if (newParticles == 0)
+            return;
+        if (newParticles > m_amount)
+            newParticles = m_amount;
+
+        m_emitShader.useShaderProgram();
+        m_emitShader.setUniformUint("amount", m_amount);
+        m_emitShader.setUniformUint("spawnCount", newParticles);
+
+        // every invocation below spawnCount increments the counter once, so the
+        // cursor is known here; restarting the counter from it mod amount keeps
+        // it from wrapping at 2^32, where % amount would jump back to a low slot
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, m_counterBuffer);
+        glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), &m_spawnCursor);
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+        m_spawnCursor = (m_spawnCursor + newParticles) % m_amount;
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_particleSSBO);
+        glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, m_counterBuffer);
+        glDispatchCompute((newParticles + emitGroupSize - 1) / emitGroupSize, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |
+                        GL_ATOMIC_COUNTER_BARRIER_BIT);
+    }
+
+    void Render() override
+    {
+        // additive blending gives a 'glow' effect; alpha blending is drawn in pool order here
+        applyBlendMode();
+        m_shader.useShaderProgram();
+        glBindVertexArray(m_VAO);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 6, m_amount);
+        glBindVertexArray(0);
+        m_drawCalls = 1;
+        // don't forget to reset to default blending mode
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+
+    ParticleBackendType getType() const override { return ParticleBackendType::COMPUTE; }
+    Shader &getShader() override { return m_shader; }
+    unsigned int getDrawCalls() const override { return m_drawCalls; }
+    std::size_t getAllocatedParticles() const override { return m_amount; }
+
+private:
+
+    // local_size_x of the two compute shaders
+    static const unsigned int updateGroupSize = 256;
+    static const unsigned int emitGroupSize = 64;
+
+    unsigned int m_amount;
+    unsigned int m_drawCalls = 0;
+    unsigned int m_frame = 0;
+    // next slot shaderComputeEmit hands out, in [0, amount)
+    GLuint m_spawnCursor = 0;
+
+    GLuint m_particleSSBO = 0;
+    GLuint m_counterBuffer = 0;
+    GLuint m_quadVBO = 0;
+    GLuint m_VAO = 0;
+
+    Shader m_shader;
+    Shader m_updateShader;
+    Shader m_emitShader;
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+// Accumulator-driven fixed timestep. Frame time is banked and drained in
+// steps of 1 / tickRate, so the simulation always advances by the same dt
+// whatever the display rate. At most maxSteps run per frame: the backlog
+// beyond that is dropped rather than carried over, so a hitch costs one
+// bounded frame instead of making the next frame slower still. What is left
+// in the accumulator is how far the display time is past the last step, the
+// factor to interpolate between the previous and the current state with.
+class FixedTimestep
+{
+public:
+
+    explicit FixedTimestep(double tickRate = 60.0, unsigned int maxSteps = 5) :
+        m_step(1.0 / tickRate), m_maxSteps(maxSteps) {}
+
+    // false and the rate unchanged unless tickRate is positive and gives a
+    // step finite even as the float getStep() returns (a denormal rate
+    // overflows 1 / tickRate)
+    bool setTickRate(double tickRate)
+    {
+        if (!(tickRate > 0.0) || !std::isfinite(tickRate))
+            return false;
+        const double step = 1.0 / tickRate;
+        if (!std::isfinite(static_cast<float>(step)) || step <= 0.0)
+            return false;
+        m_step = step;
+        return true;
+    }
+    double getTickRate() const { return 1.0 / m_step; }
+    // dt of every simulation step
+    float getStep() const { return static_cast<float>(m_step); }
+
+    // false and the limit unchanged for 0, which would drop every step
+    bool setMaxSteps(unsigned int maxSteps)
+    {
+        if (maxSteps == 0)
+            return false;
+        m_maxSteps = maxSteps;
+        return true;
+    }
+    unsigned int getMaxSteps() const { return m_maxSteps; }
+
+    // bank frameTime seconds, returns how many steps of getStep() to simulate now
+    unsigned int advance(double frameTime)
+    {
+        if (frameTime > 0.0)
+            m_accumulator += frameTime;
+        double steps = std::floor(m_accumulator / m_step);
+        if (steps > m_maxSteps)
+        {
+            // keep the fraction so interpolation stays continuous
+            m_droppedSteps += static_cast<uint64_t>(steps - m_maxSteps);
+            m_accumulator -= (steps - m_maxSteps) * m_step;
+            steps = m_maxSteps;
+        }
+        m_accumulator -= steps * m_step;
+        return static_cast<unsigned int>(steps);
+    }
+
+    // position of the display time between the last two steps, in [0, 1)
+    float getAlpha() const { return static_cast<float>(m_accumulator / m_step); }
+
+    // steps skipped because a frame needed more than maxSteps
+    uint64_t getDroppedSteps() const { return m_droppedSteps; }
+
+    void reset()
+    {
+        m_accumulator = 0.0;
+        m_droppedSteps = 0;
+    }
+
+private:
+
+    double m_step;
+    double m_accumulator = 0.0;
+    unsigned int m_maxSteps;
+    uint64_t m_droppedSteps = 0;
+};
@@ -1,6 +1,6 @@
 #pragma once
 
-GLenum glCheckError_(const char *file, int line)
+inline GLenum glCheckError_(const char *file, int line)
 {
     GLenum errorCode;
     while ((errorCode = glGetError()) != GL_NO_ERROR)
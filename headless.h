@@ -0,0 +1,154 @@
+#pragma once
+
+#include <iostream>
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+// Offscreen OpenGL core context without a window or display server: EGL on
+// Mesa's surfaceless platform (llvmpipe when there is no GPU), rendering into
+// a framebuffer object of the requested size.
+class HeadlessContext
+{
+public:
+
+    HeadlessContext(int width, int height) : m_width(width), m_height(height) {}
+
+    ~HeadlessContext()
+    {
+        if (m_context != EGL_NO_CONTEXT)
+        {
+            glDeleteRenderbuffers(1, &m_colorBuffer);
+            glDeleteFramebuffers(1, &m_framebuffer);
+            eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglDestroyContext(m_display, m_context);
+        }
+        if (m_display != EGL_NO_DISPLAY)
+            eglTerminate(m_display);
+    }
+
+    HeadlessContext(const HeadlessContext &) = delete;
+    HeadlessContext &operator=(const HeadlessContext &) = delete;
+
+    // create a major.minor core context, make it current and bind the framebuffer
+    bool create(int major, int minor)
+    {
+        if (m_display == EGL_NO_DISPLAY && !openDisplay())
+            return false;
+
+        // the default EGL_SURFACE_TYPE is window only, which surfaceless displays don't offer
+        const EGLint configAttributes[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint configCount = 0;
+        if (!eglChooseConfig(m_display, configAttributes, &config, 1, &configCount) || configCount == 0)
+        {
+            std::cerr << "[WARN] No EGL config for desktop OpenGL" << std::endl;
+            return false;
+        }
+
+        const EGLint contextAttributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION, major,
+            EGL_CONTEXT_MINOR_VERSION, minor,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        m_context = eglCreateContext(m_display, config, EGL_NO_CONTEXT, contextAttributes);
+        if (m_context == EGL_NO_CONTEXT)
+        {
+            std::cerr << "[WARN] Failed create OpenGL " << major << "." << minor << " EGL context" << std::endl;
+            return false;
+        }
+        if (!eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_context))
+        {
+            std::cerr << "[WARN] Failed make surfaceless EGL context current" << std::endl;
+            return false;
+        }
+
+        // a GLX build of GLEW loads the GL entry points and then fails to find an X display
+        glewExperimental = GL_TRUE;
+        GLenum result = glewInit();
+        if (result != GLEW_OK && result != GLEW_ERROR_NO_GLX_DISPLAY)
+        {
+            std::cerr << "[WARN] GLEW: " << glewGetErrorString(result) << std::endl;
+            return false;
+        }
+        // glewInit can leave an error behind on core contexts
+        glGetError();
+
+        glGenRenderbuffers(1, &m_colorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, m_colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, m_width, m_height);
+        glGenFramebuffers(1, &m_framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_colorBuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cerr << "[WARN] Headless framebuffer incomplete" << std::endl;
+            return false;
+        }
+        glViewport(0, 0, m_width, m_height);
+        return true;
+    }
+
+    // try major.minor first, then fallbackMajor.fallbackMinor
+    bool create(int major, int minor, int fallbackMajor, int fallbackMinor)
+    {
+        if (create(major, minor))
+            return true;
+        if (m_context != EGL_NO_CONTEXT)
+        {
+            eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglDestroyContext(m_display, m_context);
+            m_context = EGL_NO_CONTEXT;
+        }
+        return create(fallbackMajor, fallbackMinor);
+    }
+
+    // version of the context that was actually created
+    void getContextVersion(int *major, int *minor)
+    {
+        glGetIntegerv(GL_MAJOR_VERSION, major);
+        glGetIntegerv(GL_MINOR_VERSION, minor);
+    }
+
+    int getWidth() const { return m_width; }
+    int getHeight() const { return m_height; }
+
+private:
+
+    bool openDisplay()
+    {
+        // surfaceless Mesa needs no X or Wayland server, plain EGL_DEFAULT_DISPLAY otherwise
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if (getPlatformDisplay)
+            m_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (m_display == EGL_NO_DISPLAY)
+            m_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+        EGLint major, minor;
+        if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, &major, &minor))
+        {
+            std::cerr << "[WARN] Failed initilize EGL display" << std::endl;
+            m_display = EGL_NO_DISPLAY;
+            return false;
+        }
+        if (!eglBindAPI(EGL_OPENGL_API))
+        {
+            std::cerr << "[WARN] EGL has no desktop OpenGL support" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    int m_width, m_height;
+
+    EGLDisplay m_display = EGL_NO_DISPLAY;
+    EGLContext m_context = EGL_NO_CONTEXT;
+    GLuint m_framebuffer = 0;
+    GLuint m_colorBuffer = 0;
+};
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small work-stealing thread pool. Every thread owns a queue of range jobs;
+// it pops its own work LIFO and, once empty, steals FIFO from the others.
+// The thread calling parallelFor() takes part as thread 0 until its range is
+// done, so a pool of N threads spawns N - 1 workers. submit() queues
+// background jobs that only the workers run, once they are out of ranges.
+class JobSystem
+{
+public:
+
+    explicit JobSystem(unsigned int threadCount = std::thread::hardware_concurrency())
+    {
+        if (threadCount == 0)
+            threadCount = 1;
+
+        m_queues = std::vector<WorkQueue>(threadCount);
+        for (unsigned int i = 1; i < threadCount; ++i)
+            m_threads.emplace_back(&JobSystem::workerLoop, this, i);
+    }
+
+    ~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            m_running = false;
+        }
+        m_wake.notify_all();
+        for (std::thread &thread : m_threads)
+            thread.join();
+    }
+
+    JobSystem(const JobSystem &) = delete;
+    JobSystem &operator=(const JobSystem &) = delete;
+
+    // number of threads taking part in parallelFor, caller included
+    unsigned int getThreadCount() const
+    {
+        return static_cast<unsigned int>(m_queues.size());
+    }
+
+    // split [begin, end) into chunks of grain elements and run
+    // function(chunkBegin, chunkEnd) on them in parallel; returns when all are done
+    template <typename Function>
+    void parallelFor(std::size_t begin, std::size_t end, std::size_t grain, Function function)
+    {
+        if (begin >= end)
+            return;
+        if (grain == 0)
+            grain = 1;
+
+        const std::size_t chunks = (end - begin + grain - 1) / grain;
+        if (chunks == 1 || m_threads.empty())
+        {
+            function(begin, end);
+            return;
+        }
+
+        RangeTask task;
+        task.function = &function;
+        task.invoke = [](void *function, std::size_t begin, std::size_t end) {
+            (*static_cast<Function*>(function))(begin, end);
+        };
+        task.remaining.store(chunks, std::memory_order_relaxed);
+
+        // deal the chunks out round robin so every worker starts with local work
+        const std::size_t queueCount = m_queues.size();
+        for (std::size_t chunk = 0; chunk < chunks; ++chunk)
+        {
+            std::size_t chunkBegin = begin + chunk * grain;
+            std::size_t chunkEnd = chunkBegin + grain < end ? chunkBegin + grain : end;
+            WorkQueue &queue = m_queues[chunk % queueCount];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.jobs.push_back({&task, chunkBegin, chunkEnd});
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            m_pending += chunks;
+        }
+        m_wake.notify_all();
+
+        // help out until every chunk of this range has finished
+        while (task.remaining.load(std::memory_order_acquire) > 0)
+        {
+            Job job;
+            if (popOrSteal(0, job))
+                execute(job);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    // run job once on a worker, without waiting for it. Idle workers take
+    // range chunks first and the thread inside parallelFor never picks these
+    // up, but a worker that is running one is busy until it's done: every
+    // parallelFor meanwhile has one thread fewer per running job. Without
+    // workers it runs right here.
+    // Safe from any thread, also while another one is inside parallelFor().
+    void submit(std::function<void()> job)
+    {
+        if (m_threads.empty())
+        {
+            job();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_backgroundMutex);
+            m_background.push_back(std::move(job));
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            m_pending += 1;
+        }
+        m_wake.notify_one();
+    }
+
+private:
+
+    struct RangeTask
+    {
+        void *function;
+        void (*invoke)(void *, std::size_t, std::size_t);
+        std::atomic<std::size_t> remaining;
+    };
+
+    struct Job
+    {
+        RangeTask *task;
+        std::size_t begin, end;
+    };
+
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    bool popOrSteal(std::size_t index, Job &job)
+    {
+        // own queue first, newest job (still warm in cache)
+        {
+            WorkQueue &queue = m_queues[index];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.jobs.empty())
+            {
+                job = queue.jobs.back();
+                queue.jobs.pop_back();
+                m_pending.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        // then steal the oldest job of another thread
+        for (std::size_t i = 1; i < m_queues.size(); ++i)
+        {
+            WorkQueue &queue = m_queues[(index + i) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.jobs.empty())
+            {
+                job = queue.jobs.front();
+                queue.jobs.pop_front();
+                m_pending.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool popBackground(std::function<void()> &job)
+    {
+        std::lock_guard<std::mutex> lock(m_backgroundMutex);
+        if (m_background.empty())
+            return false;
+        job = std::move(m_background.front());
+        m_background.pop_front();
+        m_pending.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    static void execute(const Job &job)
+    {
+        job.task->invoke(job.task->function, job.begin, job.end);
+        job.task->remaining.fetch_sub(1, std::memory_order_release);
+    }
+
+    void workerLoop(std::size_t index)
+    {
+        for (;;)
+        {
+            Job job;
+            if (popOrSteal(index, job))
+            {
+                execute(job);
+                continue;
+            }
+            std::function<void()> background;
+            if (popBackground(background))
+            {
+                background();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_wakeMutex);
+            m_wake.wait(lock, [this]() { return !m_running || m_pending.load(std::memory_order_relaxed) > 0; });
+            if (!m_running)
+                return;
+        }
+    }
+
+    std::vector<WorkQueue> m_queues;
+    std::vector<std::thread> m_threads;
+    // submit()ted jobs, oldest first; dropped if the pool shuts down first
+    std::mutex m_backgroundMutex;
+    std::deque<std::function<void()>> m_background;
+
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wake;
+    std::atomic<std::size_t> m_pending{0};
+    bool m_running = true;
+};
+
+// run function(chunk, chunkBegin, chunkEnd) over the grain sized chunks of
+// [0, count), on the job system if there is one; chunk indexes per-chunk results
+template <typename Function>
+void parallelForChunks(JobSystem *jobSystem, std::size_t count, std::size_t grain, Function function)
+{
+    if (grain == 0)
+        grain = 1;
+    auto run = [&function, grain](std::size_t begin, std::size_t end) {
+        function(begin / grain, begin, end);
+    };
+    if (jobSystem)
+    {
+        jobSystem->parallelFor(0, count, grain, run);
+    }
+    else
+    {
+        for (std::size_t begin = 0; begin < count; begin += grain)
+            run(begin, begin + grain < count ? begin + grain : count);
+    }
+}
@@ -1,7 +1,10 @@
 #include <iostream>
 #include <fstream>
+#include <charconv>
+#include <cstring>
 #include <string>
 #include <vector>
+#include <memory>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -12,11 +15,23 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "particlesystem.h"
+#include "backendfactory.h"
+#include "benchmode.h"
+#include "fixedtimestep.h"
+#include "profiler.h"
+#include "overlay.h"
+#include "textureloader.h"
+#include "compressedtexture.h"
 #include "shaders.hpp"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "3rdparty/stb_image.h"
+// nuklear is C89, C++20 deprecates some of its enum arithmetic
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-enum-enum-conversion"
+#define NK_IMPLEMENTATION
 #include "3rdparty/nuklear.h"
+#pragma GCC diagnostic pop
 
 
 float vertices[] = {
@@ -236,17 +251,26 @@ bool firstMouse = true;
 double lastX =  800.0 / 2.0;
 double lastY =  600.0 / 2.0;
 
+// Tab hands the cursor to the overlay and back to the camera, F1 hides it
+Overlay *g_overlay = nullptr;
+bool g_overlayInput = false;
+bool g_overlayVisible = true;
+
 class GLSettings
 {
 public:
 
 
-    GLSettings() : majorVersion(3), minorVersion(3),
+    GLSettings() : majorVersion(4), minorVersion(3),
+        fallbackMajorVersion(3), fallbackMinorVersion(3),
         windowHeight(640), windowWidth(480), windowName("Hello") { }
 
     // Major version OpenGL, Minor version OpenGL
     int majorVersion, minorVersion;
 
+    // Version tried when the requested one can't be created
+    int fallbackMajorVersion, fallbackMinorVersion;
+
     // Window width, height,
     int windowHeight, windowWidth;
 
@@ -309,7 +333,8 @@ public:
         glfwSwapBuffers(m_window);
     }
 
-    void updateFpsCounter()
+    // status, if any, is appended to the counters
+    void updateFpsCounter(unsigned int drawCalls = 0, unsigned int uniformLookups = 0, const char *status = nullptr)
     {
         static double prevSecond = glfwGetTime();
         static int frameCounter = 0;
@@ -322,8 +347,9 @@ public:
             prevSecond = currentSecond;
             double fps = static_cast<double>(frameCounter) / elapsedSecond;
 
-            char buffer[256];
-            sprintf(buffer, "fps: %.2f", fps);
+            char buffer[512];
+            snprintf(buffer, sizeof(buffer), "fps: %.2f draw calls: %u uniform lookups: %u%s", fps, drawCalls, uniformLookups,
+                     status ? status : "");
             glfwSetWindowTitle(m_window, buffer);
             frameCounter = 0;
         }
@@ -343,11 +369,23 @@ public:
 
     static void scrollCallback(GLFWwindow* window, double xoffset, double yoffset)
     {
-        g_camera.updateCameraZoom(xoffset, yoffset);
+        if (g_overlayInput && g_overlay)
+            g_overlay->scroll(xoffset, yoffset);
+        else
+            g_camera.updateCameraZoom(xoffset, yoffset);
+    }
+
+    static void charCallback(GLFWwindow* window, unsigned int codepoint)
+    {
+        if (g_overlayInput && g_overlay)
+            g_overlay->character(codepoint);
     }
 
     static void mouseCursorPositionCallback(GLFWwindow* window, double x, double y)
     {
+        if (g_overlayInput)
+            return;
+
         if (firstMouse)
         {
             lastX = x;
@@ -370,6 +408,26 @@ public:
         {
             glfwSetWindowShouldClose(window, true);
         }
+
+        if (key == GLFW_KEY_TAB && action == GLFW_PRESS)
+        {
+            g_overlayInput = !g_overlayInput;
+            glfwSetInputMode(window, GLFW_CURSOR, g_overlayInput ? GLFW_CURSOR_NORMAL : GLFW_CURSOR_DISABLED);
+            // don't turn the camera by the distance the cursor moved meanwhile
+            firstMouse = true;
+        }
+
+        if (key == GLFW_KEY_F1 && action == GLFW_PRESS)
+        {
+            g_overlayVisible = !g_overlayVisible;
+        }
+    }
+
+    // version of the context that was actually created
+    void getContextVersion(int *major, int *minor)
+    {
+        glGetIntegerv(GL_MAJOR_VERSION, major);
+        glGetIntegerv(GL_MINOR_VERSION, minor);
     }
 
     void getFramebufferSize(int *width, int *height)
@@ -377,6 +435,17 @@ public:
         glfwGetFramebufferSize(m_window, width, height);
     }
 
+    // in screen coordinates, what the cursor position is measured in
+    void getWindowSize(int *width, int *height)
+    {
+        glfwGetWindowSize(m_window, width, height);
+    }
+
+    GLFWwindow *getWindow()
+    {
+        return m_window;
+    }
+
     void updateframeBufferSize()
     {
         int width, height;
@@ -386,6 +455,10 @@ public:
 
     void updateCamera(float deltaTime)
     {
+        // the keys go to the overlay while it has the cursor
+        if (g_overlayInput)
+            return;
+
         if(glfwGetKey(m_window, GLFW_KEY_W) == GLFW_PRESS)
         {
             g_camera.updateCameraDirection(CameraDirection::FORWARD_DIRECTIOM,
@@ -417,6 +490,15 @@ protected:
     {
         m_window = glfwCreateWindow(width, height, name.c_str(), NULL, NULL);
         if(!m_window)
+        {
+            std::cout << "Failed create OpenGL " << m_settings.majorVersion << "." << m_settings.minorVersion
+                      << " context, trying " << m_settings.fallbackMajorVersion << "."
+                      << m_settings.fallbackMinorVersion << std::endl;
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, m_settings.fallbackMajorVersion);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, m_settings.fallbackMinorVersion);
+            m_window = glfwCreateWindow(width, height, name.c_str(), NULL, NULL);
+        }
+        if(!m_window)
         {
             std::cout << "Failed create GLFW window!" << std::endl;
             glfwTerminate();
@@ -429,6 +511,7 @@ protected:
         glfwSetKeyCallback(m_window, keyboardCallback);
         glfwSetCursorPosCallback(m_window, mouseCursorPositionCallback);
         glfwSetScrollCallback(m_window, scrollCallback);
+        glfwSetCharCallback(m_window, charCallback);
 
         glfwSetInputMode(m_window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
@@ -497,6 +580,21 @@ public:
         return m_id;
     }
 
+    // KTX file of tools/sprite_encoder, or its RGTC companion where BC7 isn't
+    // supported; 0 if neither loads
+    unsigned int loadCompressedTexture(const std::string &name)
+    {
+        CompressedTextureInfo info;
+        m_id = ::loadCompressedTexture(name, &info);
+        if (m_id)
+        {
+            std::cerr << "Load texture: " << name << " (" << blockFormatName(info.format) << ", " << info.bytes / 1024
+                      << " KiB instead of " << info.rgbaBytes / 1024 << " KiB as RGBA8, " << info.bytesPerTexel()
+                      << " instead of 4 bytes per texel fetched)" << std::endl;
+        }
+        return m_id;
+    }
+
     unsigned int loadCubeTexture(std::vector<std::string> &faces)
     {
         unsigned int textureID;
@@ -548,8 +646,115 @@ private:
 };
 
 
-int main(void)
+// cpu|feedback|compute, false for anything else
+bool parseBackendName(const std::string &name, ParticleBackendType *type)
+{
+    if (name == "cpu")
+        *type = ParticleBackendType::CPU;
+    else if (name == "feedback")
+        *type = ParticleBackendType::TRANSFORM_FEEDBACK;
+    else if (name == "compute")
+        *type = ParticleBackendType::COMPUTE;
+    else
+        return false;
+    return true;
+}
+
+// additive|alpha, false for anything else
+bool parseBlendMode(const std::string &name, ParticleBlendMode *mode)
+{
+    if (name == "additive")
+        *mode = ParticleBlendMode::ADDITIVE;
+    else if (name == "alpha")
+        *mode = ParticleBlendMode::ALPHA;
+    else
+        return false;
+    return true;
+}
+
+// none|emitter|particles, false for anything else
+bool parseCulling(const std::string &name, ParticleCulling *culling)
+{
+    if (name == "none")
+        *culling = ParticleCulling::NONE;
+    else if (name == "emitter")
+        *culling = ParticleCulling::EMITTER;
+    else if (name == "particles")
+        *culling = ParticleCulling::PARTICLES;
+    else
+        return false;
+    return true;
+}
+
+// the whole of text as a number, false and value untouched for anything else
+template <typename T>
+bool parseNumber(const char *text, T *value)
+{
+    const char *end = text + std::strlen(text);
+    T parsed;
+    std::from_chars_result result = std::from_chars(text, end, parsed);
+    if (result.ec != std::errc() || result.ptr != end)
+        return false;
+    *value = parsed;
+    return true;
+}
+
+// --bench [frames] runs the fixed benchmark scenario headless instead of the window,
+// --bench-particles N and --bench-output file.csv|file.json configure it
+int runBenchmark(int argc, char **argv)
+{
+    BenchSettings settings;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--bench" && hasValue && argv[i + 1][0] != '-')
+        {
+            if (!parseNumber(argv[++i], &settings.frames))
+                std::cerr << "[WARN] Invalid frame count: " << argv[i] << std::endl;
+        }
+        else if (arg == "--bench-particles" && hasValue)
+        {
+            if (!parseNumber(argv[++i], &settings.particles))
+                std::cerr << "[WARN] Invalid particle count: " << argv[i] << std::endl;
+        }
+        else if (arg == "--bench-output" && hasValue)
+            settings.output = argv[++i];
+        else if (arg == "--backend" && hasValue)
+        {
+            settings.forceBackend = parseBackendName(argv[++i], &settings.backend);
+            if (!settings.forceBackend)
+                std::cerr << "[WARN] Unknown particle backend: " << argv[i] << std::endl;
+        }
+        else if (arg == "--async")
+            settings.async = true;
+        else if (arg == "--sort")
+            settings.depthSort = true;
+        else if (arg == "--blend" && hasValue)
+        {
+            if (!parseBlendMode(argv[++i], &settings.blendMode))
+                std::cerr << "[WARN] Unknown blend mode: " << argv[i] << std::endl;
+        }
+        else if (arg == "--cull" && hasValue)
+        {
+            if (!parseCulling(argv[++i], &settings.culling))
+                std::cerr << "[WARN] Unknown culling mode: " << argv[i] << std::endl;
+        }
+        else if (arg == "--bench-sprite" && hasValue)
+            settings.sprite = argv[++i];
+    }
+    BenchRunner runner(settings);
+    return runner.run();
+}
+
+int main(int argc, char **argv)
 {
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--bench")
+            return runBenchmark(argc, argv);
+    }
+
     GLSettings settings;
     settings.windowName = "Hello OpenGL";
     settings.windowHeight = 800;
@@ -557,15 +762,103 @@ int main(void)
 
     GLWindow window(settings);
 
-    Shader shader;
-    shader.loadShader(shaderVertex, TypeShader::VERTEX_SHADER);
-    shader.loadShader(shaderFragment, TypeShader::FRAGMENT_SHADER);
-    shader.createShaderProgram();
+    int majorVersion, minorVersion;
+    window.getContextVersion(&majorVersion, &minorVersion);
+    ParticleBackendType backendType = selectParticleBackend(majorVersion, minorVersion);
+    // the simulation runs at a fixed rate, independent of the display
+    FixedTimestep timestep;
+    bool async = false;
+    // --blend alpha --sort draws smoke back to front, see DepthSorter
+    bool depthSort = false;
+    ParticleBlendMode blendMode = ParticleBlendMode::ADDITIVE;
+    // --cull emitter|particles skips what the camera can't see
+    ParticleCulling culling = ParticleCulling::NONE;
+    // --profile-output file.csv|file.json writes the phase timings on exit
+    std::string profileOutput;
+    // --sprite file.ktx draws every particle with a compressed sprite instead of the atlas
+    std::string compressedSprite;
+    // --texture-cache dir keeps decoded mip chains between runs, "" turns it off
+    std::string textureCache = "texture_cache";
+    // --program-cache dir keeps linked shader programs between runs, "" turns it off
+    std::string programCache = "program_cache";
+    // --backend cpu|feedback|compute overrides the automatic choice
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--backend" && hasValue)
+        {
+            if (!parseBackendName(argv[++i], &backendType))
+                std::cerr << "[WARN] Unknown particle backend: " << argv[i] << std::endl;
+        }
+        else if (arg == "--tick-rate" && hasValue)
+        {
+            double tickRate = 0.0;
+            if (!parseNumber(argv[++i], &tickRate) || !timestep.setTickRate(tickRate))
+                std::cerr << "[WARN] Tick rate must be a positive number of steps per second: " << argv[i] << std::endl;
+        }
+        else if (arg == "--max-steps" && hasValue)
+        {
+            unsigned int maxSteps = 0;
+            if (!parseNumber(argv[++i], &maxSteps) || !timestep.setMaxSteps(maxSteps))
+                std::cerr << "[WARN] Max steps must be a positive number of steps per frame: " << argv[i] << std::endl;
+        }
+        else if (arg == "--async")
+            async = true;
+        else if (arg == "--sort")
+            depthSort = true;
+        else if (arg == "--blend" && hasValue)
+        {
+            if (!parseBlendMode(argv[++i], &blendMode))
+                std::cerr << "[WARN] Unknown blend mode: " << argv[i] << std::endl;
+        }
+        else if (arg == "--cull" && hasValue)
+        {
+            if (!parseCulling(argv[++i], &culling))
+                std::cerr << "[WARN] Unknown culling mode: " << argv[i] << std::endl;
+        }
+        else if (arg == "--profile-output" && hasValue)
+            profileOutput = argv[++i];
+        else if (arg == "--sprite" && hasValue)
+            compressedSprite = argv[++i];
+        else if (arg == "--texture-cache" && hasValue)
+            textureCache = argv[++i];
+        else if (arg == "--program-cache" && hasValue)
+            programCache = argv[++i];
+    }
+    // a 3.3 fallback context has no compute shaders, asking for them anyway runs on the CPU
+    if (backendType == ParticleBackendType::COMPUTE &&
+        selectParticleBackend(majorVersion, minorVersion) != ParticleBackendType::COMPUTE)
+    {
+        std::cerr << "[WARN] Compute backend needs OpenGL 4.3, got " << majorVersion << "." << minorVersion
+                  << ", using cpu" << std::endl;
+        backendType = ParticleBackendType::CPU;
+    }
+    std::cerr << "OpenGL " << majorVersion << "." << minorVersion
+              << ", particle backend: " << particleBackendName(backendType) << std::endl;
 
     Texture texture;
-
-    ParticleSystem pSys(shader,200);
-    pSys.Initialize();
+    Shader::setProgramCacheDirectory(programCache);
+
+    JobSystem jobSystem;
+
+    // backend, pool size and spawn rate, changed at run time from the overlay
+    OverlayControls controls;
+    controls.backend = backendType;
+    controls.computeAvailable = selectParticleBackend(majorVersion, minorVersion) == ParticleBackendType::COMPUTE;
+    auto createBackend = [&]() {
+        std::unique_ptr<ParticleBackend> system = createParticleBackend(controls.backend, controls.poolSize, &jobSystem);
+        system->Initialize();
+        // --async simulates the next frame on its own thread while this one renders
+        system->setAsyncSimulation(async);
+        system->setBlendMode(blendMode);
+        system->setDepthSort(depthSort);
+        system->setCulling(culling);
+        system->getShader().useShaderProgram();
+        system->getShader().setUniformInt("sprite", 0);
+        return system;
+    };
+    std::unique_ptr<ParticleBackend> pSys = createBackend();
     //pSys.AddParticles(10,glm::vec2(0.1f,0.1f),glm::vec2(1,1),10,100,glm::vec2(0,0));
 
    /* ParticleSystem pSys2(shader, 2);
@@ -573,10 +866,34 @@ int main(void)
     pSys2.AddParticles(10,glm::vec2(0.1f,0.1f),glm::vec2(10,10),10,100,glm::vec2(0,0));
     */
 
-    texture.loadTexture("smoke-particle-texture-399x385.png");
+    // one atlas for every particle sprite, so the rain (smoke) and the filled
+    // pool (box) share a binding and a draw call; decoded and packed on the
+    // job system, the particles draw with a placeholder until it is in
+    enum ParticleSprite { SPRITE_SMOKE, SPRITE_BOX };
+    TextureLoader textureLoader(&jobSystem);
+    textureLoader.setCacheDirectory(textureCache);
+    GLuint sprite = compressedSprite.empty() ? 0 : texture.loadCompressedTexture(compressedSprite);
+    // the rects go to the render shader once the atlas is in, and again for a rebuilt backend;
+    // a single compressed sprite keeps the whole texture rects. A KTX that
+    // doesn't load, its RGTC companion neither, leaves the RGBA8 PNG atlas
+    const bool atlas = sprite == 0;
+    if (atlas)
+        sprite = textureLoader.loadAtlas({ "smoke-particle-texture-399x385.png", "box.png" });
+    bool spritesSet = !atlas;
     texture.glEnableGlBlend();
-    shader.useShaderProgram();
-    glUniform1i(glGetUniformLocation(shader.getShaderProgram(), "sprite"), 0);
+
+    Overlay overlay;
+    overlay.Initialize();
+    g_overlay = &overlay;
+    PerformancePanel panel;
+
+    // every program of the startup path exists by now
+    const ProgramCacheStats &programs = Shader::getProgramCacheStats();
+    std::cerr << "Shader programs: " << programs.loaded << " loaded from cache in " << programs.loadMs << " ms, "
+              << programs.compiled << " compiled in " << programs.compileMs << " ms";
+    if (programs.rejected > 0)
+        std::cerr << " (" << programs.rejected << " cached binaries rejected)";
+    std::cerr << ", startup " << programs.savedMs << " ms faster than compiling" << std::endl;
 
     // timing
     float deltaTime = 0.0f;	// time between current frame and last frame
@@ -586,6 +903,10 @@ int main(void)
     glm::mat4 projection;
 
 
+    // CPU and GPU time of every phase, shown in the title
+    Profiler &profiler = Profiler::instance();
+    profiler.setGpuTiming(true);
+
     // render loop
     // -----------
     while (!window.checkCloseWindow())
@@ -595,10 +916,28 @@ int main(void)
         lastFrame = currentFrame;
 
 
-        window.updateFpsCounter();
+        char cullStatus[64] = "";
+        if (culling != ParticleCulling::NONE)
+            snprintf(cullStatus, sizeof(cullStatus), " particles drawn: %zu culled: %zu",
+                     pSys->getDrawnParticles(), pSys->getCulledParticles());
+        // average cpu/gpu ms per phase
+        const std::string status = std::string(cullStatus) + " | " + profiler.getSummary();
+        window.updateFpsCounter(pSys->getDrawCalls(), Shader::takeUniformLocationQueries(), status.c_str());
         window.updateframeBufferSize();
         window.updateCamera(deltaTime);
 
+        if (g_overlayVisible)
+            panel.layout(overlay, *pSys, controls);
+        if (controls.rebuild)
+        {
+            glDeleteProgram(pSys->getShader().getShaderProgram());
+            pSys.reset();
+            pSys = createBackend();
+            spritesSet = !atlas;
+        }
+        if (controls.fill)
+            pSys->AddParticles(SPRITE_BOX, glm::vec3(0.0f), glm::vec3(0.0f), 0.0f, controls.poolSize, glm::vec3(0.0f));
+
 
         // render
         // ------
@@ -607,14 +946,46 @@ int main(void)
         // bind textures on corresponding texture units
 
 
-        pSys.Update(deltaTime, 100);
+        // catch up in fixed steps, then draw in between the last two of them
+        const unsigned int steps = timestep.advance(deltaTime);
+        {
+            PROFILE_ZONE("update");
+            for (unsigned int step = 0; step < steps; ++step)
+                pSys->Simulate(timestep.getStep(), controls.spawnRate, glm::vec3(1.0f, 2.0f, 3.0f));
+        }
+        pSys->setInterpolation(timestep.getAlpha());
+
+        // the camera of this frame, Upload culls and sorts for it
+        projection = glm::perspective(glm::radians(g_camera.getFov()),
+                                      static_cast<float>(window.getWidthWindow()) /
+                                          static_cast<float>(window.getHeightWindow()),
+                                      0.1f,
+                                      100.0f);
+        view = g_camera.getLookAtCamera();
+        model = glm::mat4(1.0f);
+        pSys->setViewer(g_camera.getCameraPosition(), g_camera.getCameraFront());
+        pSys->setFrustum(projection * view * model);
+        {
+            PROFILE_ZONE("upload");
+            textureLoader.update();
+            pSys->Upload();
+        }
         //pSys2.Update(deltaTime, 10);
 
         glActiveTexture(GL_TEXTURE0);
-        //glBindTexture(GL_TEXTURE_2D, texture1);
+        glBindTexture(GL_TEXTURE_2D, sprite);
 
         // render container
+        Shader &shader = pSys->getShader();
         shader.useShaderProgram();
+        if (!spritesSet)
+        {
+            if (const std::vector<glm::vec4> *rects = textureLoader.getSpriteRects(sprite))
+            {
+                setParticleSprites(shader, *rects);
+                spritesSet = true;
+            }
+        }
 
         /*glm::mat4 trans = glm::mat4(1.0f);
         trans = glm::rotate(trans, glm::radians(0.0f), glm::vec3(0.0, 0.0, 1.0));
@@ -623,25 +994,38 @@ int main(void)
         unsigned int transformLoc = glGetUniformLocation(shader.getShaderProgram(), "transform");
         glUniformMatrix4fv(transformLoc, 1, GL_FALSE, glm::value_ptr(trans));
         */
-        projection = glm::perspective(glm::radians(g_camera.getFov()),
-                                      static_cast<float>(window.getWidthWindow()) /
-                                          static_cast<float>(window.getHeightWindow()),
-                                      0.1f,
-                                      100.0f);
         shader.setUniformMatrix4x4("projection", projection);
-
-        view = g_camera.getLookAtCamera();
         shader.setUniformMatrix4x4("view", view);
-
-        model = glm::mat4(1.0f);
         shader.setUniformMatrix4x4("model", model);
 
-        pSys.Render();
+        {
+            PROFILE_ZONE("render");
+            pSys->Render();
+        }
         //pSys2.Render();
 
-        window.checkSwapBuffer();
+        if (g_overlayVisible)
+        {
+            PROFILE_ZONE("overlay");
+            int width, height, framebufferWidth, framebufferHeight;
+            window.getWindowSize(&width, &height);
+            window.getFramebufferSize(&framebufferWidth, &framebufferHeight);
+            overlay.render(width, height, framebufferWidth, framebufferHeight);
+        }
+
+        {
+            PROFILE_ZONE("swap");
+            window.checkSwapBuffer();
+        }
+        overlay.beginInput();
         window.checkPoolEvents();
+        overlay.endInput(window.getWindow(), g_overlayInput);
+        profiler.endFrame();
     }
+    g_overlay = nullptr;
+
+    if (!profileOutput.empty() && profiler.dump(profileOutput))
+        std::cerr << "profile: wrote " << profileOutput << std::endl;
 
 
     return 0;
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+// one level of a mip chain packed into a single allocation
+struct MipLevel
+{
+    int width, height;
+    std::size_t offset;
+};
+
+// 2x2 box filter of a width x height image into the next mip level, the last
+// row and column of odd sizes are repeated
+inline void downsampleImage(const unsigned char *source, int width, int height, int channels, unsigned char *target)
+{
+    const int targetWidth = std::max(width / 2, 1);
+    const int targetHeight = std::max(height / 2, 1);
+    for (int y = 0; y < targetHeight; ++y)
+    {
+        const unsigned char *row0 = source + static_cast<std::size_t>(std::min(2 * y, height - 1)) * width * channels;
+        const unsigned char *row1 = source + static_cast<std::size_t>(std::min(2 * y + 1, height - 1)) * width * channels;
+        unsigned char *out = target + static_cast<std::size_t>(y) * targetWidth * channels;
+        for (int x = 0; x < targetWidth; ++x)
+        {
+            const int x0 = std::min(2 * x, width - 1) * channels;
+            const int x1 = std::min(2 * x + 1, width - 1) * channels;
+            for (int c = 0; c < channels; ++c)
+                out[x * channels + c] = static_cast<unsigned char>((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+        }
+    }
+}
+
+// levels of a full mip chain down to 1x1, packed one after the other; the
+// first is the image itself, returns the size of the whole chain
+inline std::size_t mipChainLevels(int width, int height, int channels, std::vector<MipLevel> &levels)
+{
+    levels.clear();
+    std::size_t offset = 0;
+    for (;;)
+    {
+        levels.push_back({ width, height, offset });
+        offset += static_cast<std::size_t>(width) * height * channels;
+        if (width == 1 && height == 1)
+            return offset;
+        width = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+    }
+}
@@ -0,0 +1,388 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <iostream>
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+// main.cpp compiles the implementation with the same configuration
+#define NK_INCLUDE_FIXED_TYPES
+#define NK_INCLUDE_STANDARD_IO
+#define NK_INCLUDE_STANDARD_VARARGS
+#define NK_INCLUDE_DEFAULT_ALLOCATOR
+#define NK_INCLUDE_VERTEX_BUFFER_OUTPUT
+#define NK_INCLUDE_FONT_BAKING
+#define NK_INCLUDE_DEFAULT_FONT
+#include "3rdparty/nuklear.h"
+
+#include "shaders.hpp"
+#include "streambuffer.h"
+#include "profiler.h"
+#include "particlebackend.h"
+
+// vertex nk_convert writes for shaderOverlayVertex
+struct OverlayVertex
+{
+    float position[2];
+    float texCoord[2];
+    nk_byte color[4];
+};
+
+// Nuklear context drawn on top of the scene. nk_convert writes the vertices
+// and indices of the whole UI straight into one region of a StreamBuffer,
+// so the overlay costs a single upload per frame and one draw per scissor
+// rectangle, and never waits for the GPU.
+class Overlay
+{
+public:
+
+    // room for the vertices and indices of one frame
+    static const std::size_t vertexBytes = 512 * 1024;
+    static const std::size_t elementBytes = 128 * 1024;
+
+    Overlay() {}
+
+    ~Overlay()
+    {
+        if (m_VAO == 0)
+            return;
+        nk_font_atlas_clear(&m_atlas);
+        nk_buffer_free(&m_commands);
+        nk_free(&m_context);
+        glDeleteTextures(1, &m_fontTexture);
+        glDeleteVertexArrays(1, &m_VAO);
+        glDeleteProgram(m_shader.getShaderProgram());
+    }
+
+    Overlay(const Overlay &) = delete;
+    Overlay &operator=(const Overlay &) = delete;
+
+    // needs the GL context the overlay is drawn in
+    void Initialize()
+    {
+        m_shader.loadShader(shaderOverlayVertex, TypeShader::VERTEX_SHADER);
+        m_shader.loadShader(shaderOverlayFragment, TypeShader::FRAGMENT_SHADER);
+        m_shader.createShaderProgram();
+
+        // bake the default font, its white pixel textures the untextured shapes
+        nk_font_atlas_init_default(&m_atlas);
+        nk_font_atlas_begin(&m_atlas);
+        struct nk_font *font = nk_font_atlas_add_default(&m_atlas, 13.0f, nullptr);
+        int width, height;
+        const void *image = nk_font_atlas_bake(&m_atlas, &width, &height, NK_FONT_ATLAS_RGBA32);
+        GLint sceneTexture = 0;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &sceneTexture);
+        glGenTextures(1, &m_fontTexture);
+        glBindTexture(GL_TEXTURE_2D, m_fontTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
+        glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(sceneTexture));
+        nk_font_atlas_end(&m_atlas, nk_handle_id(static_cast<int>(m_fontTexture)), &m_null);
+        nk_init_default(&m_context, &font->handle);
+        nk_buffer_init_default(&m_commands);
+
+        // vertices at the start of every region, indices behind them; the
+        // attribute pointers follow the current region in render
+        m_stream.Initialize(vertexBytes + elementBytes);
+        glGenVertexArrays(1, &m_VAO);
+        glBindVertexArray(m_VAO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_stream.getBuffer());
+        glEnableVertexAttribArray(0);
+        glEnableVertexAttribArray(1);
+        glEnableVertexAttribArray(2);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+
+    nk_context *getContext() { return &m_context; }
+
+    // glfwPollEvents goes between beginInput and endInput, scroll and
+    // character are fed from the GLFW callbacks in between
+    void beginInput() { nk_input_begin(&m_context); }
+    void scroll(double x, double y) { nk_input_scroll(&m_context, nk_vec2(static_cast<float>(x), static_cast<float>(y))); }
+    void character(unsigned int codepoint) { nk_input_unicode(&m_context, codepoint); }
+
+    // without interactive the cursor belongs to the camera and the UI sees no mouse
+    void endInput(GLFWwindow *window, bool interactive)
+    {
+        double x = -1.0, y = -1.0;
+        if (interactive)
+            glfwGetCursorPos(window, &x, &y);
+        const bool pressed = interactive && glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+        nk_input_motion(&m_context, static_cast<int>(x), static_cast<int>(y));
+        nk_input_button(&m_context, NK_BUTTON_LEFT, static_cast<int>(x), static_cast<int>(y), pressed);
+
+        auto key = [window, interactive](int glfwKey) { return interactive && glfwGetKey(window, glfwKey) == GLFW_PRESS; };
+        nk_input_key(&m_context, NK_KEY_BACKSPACE, key(GLFW_KEY_BACKSPACE));
+        nk_input_key(&m_context, NK_KEY_DEL, key(GLFW_KEY_DELETE));
+        nk_input_key(&m_context, NK_KEY_ENTER, key(GLFW_KEY_ENTER));
+        nk_input_key(&m_context, NK_KEY_LEFT, key(GLFW_KEY_LEFT));
+        nk_input_key(&m_context, NK_KEY_RIGHT, key(GLFW_KEY_RIGHT));
+        nk_input_end(&m_context);
+    }
+
+    // draw what was laid out since the last render; width and height in
+    // window coordinates, the framebuffer may be larger on high dpi screens
+    void render(int width, int height, int framebufferWidth, int framebufferHeight)
+    {
+        static const struct nk_draw_vertex_layout_element vertexLayout[] = {
+            { NK_VERTEX_POSITION, NK_FORMAT_FLOAT, offsetof(OverlayVertex, position) },
+            { NK_VERTEX_TEXCOORD, NK_FORMAT_FLOAT, offsetof(OverlayVertex, texCoord) },
+            { NK_VERTEX_COLOR, NK_FORMAT_R8G8B8A8, offsetof(OverlayVertex, color) },
+            { NK_VERTEX_LAYOUT_END }
+        };
+        struct nk_convert_config config = {};
+        config.vertex_layout = vertexLayout;
+        config.vertex_size = sizeof(OverlayVertex);
+        config.vertex_alignment = alignof(OverlayVertex);
+        config.null = m_null;
+        config.circle_segment_count = 22;
+        config.curve_segment_count = 22;
+        config.arc_segment_count = 22;
+        config.global_alpha = 1.0f;
+        config.shape_AA = NK_ANTI_ALIASING_ON;
+        config.line_AA = NK_ANTI_ALIASING_ON;
+
+        m_drawCalls = 0;
+        m_uploadedBytes = 0;
+        char *region = static_cast<char*>(m_stream.map());
+        nk_flags result = NK_CONVERT_INVALID_PARAM;
+        struct nk_buffer vertices, elements;
+        if (region)
+        {
+            nk_buffer_init_fixed(&vertices, region, vertexBytes);
+            nk_buffer_init_fixed(&elements, region + vertexBytes, elementBytes);
+            result = nk_convert(&m_context, &m_commands, &vertices, &elements, &config);
+        }
+        m_stream.unmap();
+        if (result != NK_CONVERT_SUCCESS)
+        {
+            if (region && !m_warnedFull)
+                std::cerr << "[WARN] Overlay needs more than " << vertexBytes + elementBytes << " bytes, not drawn" << std::endl;
+            m_warnedFull = region != nullptr;
+            clear();
+            return;
+        }
+        m_uploadedBytes = vertices.allocated + elements.allocated;
+
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glEnable(GL_SCISSOR_TEST);
+        m_shader.useShaderProgram();
+        m_shader.setUniformInt("glyphs", 0);
+        m_shader.setUniformMatrix4x4("projection", glm::ortho(0.0f, static_cast<float>(width), static_cast<float>(height), 0.0f));
+        // the scene keeps its texture on unit 0 across frames
+        glActiveTexture(GL_TEXTURE0);
+        GLint sceneTexture = 0;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &sceneTexture);
+
+        const std::size_t offset = m_stream.getOffset();
+        glBindVertexArray(m_VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, m_stream.getBuffer());
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(OverlayVertex), (void*)(offset + offsetof(OverlayVertex, position)));
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(OverlayVertex), (void*)(offset + offsetof(OverlayVertex, texCoord)));
+        glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(OverlayVertex), (void*)(offset + offsetof(OverlayVertex, color)));
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        const float scaleX = static_cast<float>(framebufferWidth) / static_cast<float>(std::max(width, 1));
+        const float scaleY = static_cast<float>(framebufferHeight) / static_cast<float>(std::max(height, 1));
+        const GLenum indexType = sizeof(nk_draw_index) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        std::size_t elementOffset = offset + vertexBytes;
+        const struct nk_draw_command *command;
+        nk_draw_foreach(command, &m_context, &m_commands)
+        {
+            if (command->elem_count == 0)
+                continue;
+            glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(command->texture.id));
+            glScissor(static_cast<GLint>(command->clip_rect.x * scaleX),
+                      static_cast<GLint>((height - (command->clip_rect.y + command->clip_rect.h)) * scaleY),
+                      static_cast<GLint>(command->clip_rect.w * scaleX),
+                      static_cast<GLint>(command->clip_rect.h * scaleY));
+            glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(command->elem_count), indexType, (void*)elementOffset);
+            elementOffset += command->elem_count * sizeof(nk_draw_index);
+            ++m_drawCalls;
+        }
+        // the region can be written again once these draws have finished
+        m_stream.fence();
+
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(sceneTexture));
+        glDisable(GL_SCISSOR_TEST);
+        clear();
+    }
+
+    // drop what was laid out without drawing it
+    void clear()
+    {
+        nk_clear(&m_context);
+        nk_buffer_clear(&m_commands);
+    }
+
+    // of the last render
+    unsigned int getDrawCalls() const { return m_drawCalls; }
+    std::size_t getUploadedBytes() const { return m_uploadedBytes; }
+
+private:
+
+    nk_context m_context;
+    struct nk_font_atlas m_atlas;
+    struct nk_draw_null_texture m_null;
+    struct nk_buffer m_commands;
+    Shader m_shader;
+    StreamBuffer m_stream;
+    GLuint m_fontTexture = 0;
+    GLuint m_VAO = 0;
+    unsigned int m_drawCalls = 0;
+    std::size_t m_uploadedBytes = 0;
+    bool m_warnedFull = false;
+};
+
+// what the PerformancePanel controls; main applies the requests
+struct OverlayControls
+{
+    ParticleBackendType backend = ParticleBackendType::CPU;
+    // the compute backend needs a GL 4.3 context
+    bool computeAvailable = false;
+    int poolSize = 200;
+    // particles rained every simulation step
+    int spawnRate = 100;
+    // set for one frame: rebuild the backend with backend and poolSize,
+    // spawn a whole pool of particles at once
+    bool rebuild = false;
+    bool fill = false;
+};
+
+// Live numbers of the particle backend and the Profiler, plus controls for
+// load testing: backend, pool size and spawn rate.
+class PerformancePanel
+{
+public:
+
+    void layout(Overlay &overlay, const ParticleBackend &system, OverlayControls &controls)
+    {
+        nk_context *context = overlay.getContext();
+        controls.rebuild = false;
+        controls.fill = false;
+        if (nk_begin(context, "Performance", nk_rect(10.0f, 10.0f, 320.0f, 520.0f),
+                     NK_WINDOW_BORDER | NK_WINDOW_MOVABLE | NK_WINDOW_SCALABLE | NK_WINDOW_MINIMIZABLE | NK_WINDOW_TITLE))
+        {
+            layoutTimings(context);
+            layoutParticles(context, overlay, system);
+            layoutControls(context, controls);
+        }
+        nk_end(context);
+    }
+
+private:
+
+    // frame times and per-phase timings of the last RollingHistogram::window frames
+    void layoutTimings(nk_context *context)
+    {
+        const Profiler &profiler = Profiler::instance();
+        const RollingHistogram &frames = profiler.getFrameTimes();
+        const double average = frames.average();
+        nk_layout_row_dynamic(context, 16.0f, 1);
+        nk_labelf(context, NK_TEXT_LEFT, "frame %.2f ms, %.0f fps, p99 %.2f ms",
+                  average, average > 0.0 ? 1000.0 / average : 0.0, frames.percentile(0.99));
+
+        // 0 to 33 ms unless a spike needs more, 60 fps sits in the middle
+        nk_layout_row_dynamic(context, 60.0f, 1);
+        const float frameScale = static_cast<float>(std::max(frames.maximum(), 1000.0 / 30.0));
+        if (nk_chart_begin(context, NK_CHART_LINES, static_cast<int>(RollingHistogram::window), 0.0f, frameScale))
+        {
+            for (std::size_t i = 0; i < frames.size(); ++i)
+                nk_chart_push(context, static_cast<float>(frames.sample(i)));
+            nk_chart_end(context);
+        }
+
+        // cpu time of the first zones, one colored line each
+        const unsigned int zones = static_cast<unsigned int>(std::min<std::size_t>(profiler.getZoneCount(), NK_CHART_MAX_SLOT));
+        double phaseScale = 1.0;
+        for (unsigned int z = 0; z < zones; ++z)
+            phaseScale = std::max(phaseScale, profiler.getZone(z).cpu.maximum());
+        nk_layout_row_dynamic(context, 60.0f, 1);
+        if (zones > 0 && nk_chart_begin_colored(context, NK_CHART_LINES, zoneColor(0), zoneColor(0),
+                                                static_cast<int>(RollingHistogram::window), 0.0f, static_cast<float>(phaseScale)))
+        {
+            for (unsigned int z = 1; z < zones; ++z)
+                nk_chart_add_slot_colored(context, NK_CHART_LINES, zoneColor(z), zoneColor(z),
+                                          static_cast<int>(RollingHistogram::window), 0.0f, static_cast<float>(phaseScale));
+            for (unsigned int z = 0; z < zones; ++z)
+            {
+                const RollingHistogram &cpu = profiler.getZone(z).cpu;
+                for (std::size_t i = 0; i < cpu.size(); ++i)
+                    nk_chart_push_slot(context, static_cast<float>(cpu.sample(i)), static_cast<int>(z));
+            }
+            nk_chart_end(context);
+        }
+
+        nk_layout_row_dynamic(context, 16.0f, 4);
+        nk_label(context, "phase", NK_TEXT_LEFT);
+        nk_label(context, "cpu ms", NK_TEXT_RIGHT);
+        nk_label(context, "p99 ms", NK_TEXT_RIGHT);
+        nk_label(context, "gpu ms", NK_TEXT_RIGHT);
+        for (unsigned int z = 0; z < profiler.getZoneCount(); ++z)
+        {
+            const Profiler::Zone &zone = profiler.getZone(z);
+            nk_label_colored(context, zone.name.c_str(), NK_TEXT_LEFT, z < zones ? zoneColor(z) : nk_rgb(200, 200, 200));
+            nk_labelf(context, NK_TEXT_RIGHT, "%.3f", zone.cpu.average());
+            nk_labelf(context, NK_TEXT_RIGHT, "%.3f", zone.cpu.percentile(0.99));
+            if (profiler.isGpuTiming())
+                nk_labelf(context, NK_TEXT_RIGHT, "%.3f", zone.gpu.average());
+            else
+                nk_label(context, "-", NK_TEXT_RIGHT);
+        }
+    }
+
+    void layoutParticles(nk_context *context, const Overlay &overlay, const ParticleBackend &system)
+    {
+        const std::size_t live = system.getLiveParticles();
+        const std::size_t allocated = system.getAllocatedParticles();
+        nk_layout_row_dynamic(context, 16.0f, 1);
+        nk_labelf(context, NK_TEXT_LEFT, "particles %zu live / %zu allocated", live, allocated);
+        // pool occupancy
+        nk_size occupied = live;
+        nk_progress(context, &occupied, allocated, NK_FIXED);
+        nk_labelf(context, NK_TEXT_LEFT, "drawn %zu, culled %zu", system.getDrawnParticles(), system.getCulledParticles());
+        nk_labelf(context, NK_TEXT_LEFT, "draw calls %u + %u overlay", system.getDrawCalls(), overlay.getDrawCalls());
+        nk_labelf(context, NK_TEXT_LEFT, "uploaded %.1f + %.1f KiB overlay",
+                  system.getUploadedBytes() / 1024.0, overlay.getUploadedBytes() / 1024.0);
+    }
+
+    void layoutControls(nk_context *context, OverlayControls &controls)
+    {
+        static const char *backends[] = { "cpu", "transform feedback", "compute" };
+        nk_layout_row_dynamic(context, 20.0f, 1);
+        const int available = controls.computeAvailable ? 3 : 2;
+        const int current = static_cast<int>(controls.backend);
+        const int selected = nk_combo(context, backends, available, current, 20, nk_vec2(200.0f, 90.0f));
+        if (selected != current)
+        {
+            controls.backend = static_cast<ParticleBackendType>(selected);
+            controls.rebuild = true;
+        }
+        nk_property_int(context, "#spawn per step", 0, &controls.spawnRate, 1000000, 10, 10.0f);
+
+        // the pool is only resized on rebuild, dragging would recreate it every frame
+        nk_layout_row_dynamic(context, 20.0f, 2);
+        nk_property_int(context, "#pool", 1, &controls.poolSize, 4000000, 1000, 1000.0f);
+        if (nk_button_label(context, "rebuild"))
+            controls.rebuild = true;
+        nk_layout_row_dynamic(context, 20.0f, 1);
+        if (nk_button_label(context, "fill pool"))
+            controls.fill = true;
+    }
+
+    static struct nk_color zoneColor(unsigned int zone)
+    {
+        static const struct nk_color colors[] = {
+            { 255, 160, 60, 255 }, { 90, 200, 250, 255 }, { 140, 230, 110, 255 }, { 230, 100, 200, 255 }
+        };
+        return colors[zone % 4];
+    }
+};
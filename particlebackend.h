@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <glm/glm.hpp>
+
+#include "shaders.hpp"
+#include "particlecull.h"
+
+enum class ParticleBackendType
+{
+    CPU,
+    TRANSFORM_FEEDBACK,
+    COMPUTE
+};
+
+inline const char *particleBackendName(ParticleBackendType type)
+{
+    switch (type)
+    {
+    case ParticleBackendType::CPU:                return "cpu";
+    case ParticleBackendType::TRANSFORM_FEEDBACK: return "transform feedback";
+    case ParticleBackendType::COMPUTE:            return "compute";
+    }
+    return "unknown";
+}
+
+// additive glows and needs no order, alpha (smoke) wants back-to-front order
+enum class ParticleBlendMode
+{
+    ADDITIVE,
+    ALPHA
+};
+
+// Common interface of the particle simulation backends. Every backend owns
+// the shader it renders with, the caller sets the camera uniforms on it.
+class ParticleBackend
+{
+public:
+
+    virtual ~ParticleBackend() {}
+
+    virtual void Initialize() = 0;
+    virtual void Render() = 0;
+    // advance the simulation
+    virtual void Simulate(float dt, unsigned int newParticles, glm::vec3 offset) = 0;
+    // hand the simulated state to the GPU for the next Render, if the backend needs to
+    virtual void Upload() {}
+    // how far the next Upload is between the previous (0) and the last simulated
+    // step (1), for a fixed timestep; backends without the previous state ignore it
+    virtual void setInterpolation(float alpha) {}
+    // run the simulation on its own thread, overlapping the next frame's update with
+    // this frame's render; GPU backends already overlap with the CPU and ignore it
+    virtual void setAsyncSimulation(bool async) {}
+    // draw back to front as seen from the last setViewer; only the CPU backend
+    // sorts, the GPU backends keep their state on the GPU and draw in pool order
+    virtual void setDepthSort(bool sort) {}
+    virtual void setViewer(glm::vec3 position, glm::vec3 front) {}
+    // leave out what is outside the frustum of the last setFrustum (projection
+    // * view); only the CPU backend culls, the GPU backends never read their
+    // particles back and draw all of them
+    virtual void setCulling(ParticleCulling culling) {}
+    virtual void setFrustum(const glm::mat4 &viewProjection) {}
+    // particles the last Upload handed to Render and the ones culling left out
+    virtual std::size_t getDrawnParticles() const { return 0; }
+    virtual std::size_t getCulledParticles() const { return 0; }
+    // size of the particle pool and how much of it was alive at the last
+    // Upload; the GPU backends never read their pool back and draw all of it
+    virtual std::size_t getAllocatedParticles() const = 0;
+    virtual std::size_t getLiveParticles() const { return getAllocatedParticles(); }
+    // bytes the last Upload streamed to the GPU, the GPU backends simulate in place
+    virtual std::size_t getUploadedBytes() const { return 0; }
+
+    void setBlendMode(ParticleBlendMode mode) { m_blendMode = mode; }
+    ParticleBlendMode getBlendMode() const { return m_blendMode; }
+    virtual void AddParticles(short int type, glm::vec3 position, glm::vec3 velocity, float rotation, unsigned int newParticles, glm::vec3 offset) = 0;
+
+    virtual ParticleBackendType getType() const = 0;
+    virtual Shader &getShader() = 0;
+    virtual unsigned int getDrawCalls() const = 0;
+
+    void Update(float dt, unsigned int newParticles, glm::vec3 offset)
+    {
+        Simulate(dt, newParticles, offset);
+        Upload();
+    }
+
+protected:
+
+    // glBlendFunc of the blend mode, Render restores GL_ONE_MINUS_SRC_ALPHA afterwards
+    void applyBlendMode() const
+    {
+        if (m_blendMode == ParticleBlendMode::ADDITIVE)
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+        else
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+
+    ParticleBlendMode m_blendMode = ParticleBlendMode::ADDITIVE;
+};
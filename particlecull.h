@@ -0,0 +1,383 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "particlesimulation.h"
+#include "particlekernels.h"
+#include "jobsystem.h"
+
+// what the CPU backend leaves out before the upload
+enum class ParticleCulling
+{
+    NONE,
+    EMITTER,    // the whole emitter when its bounds are outside the frustum
+    PARTICLES   // that, and then every particle outside it
+};
+
+inline const char *particleCullingName(ParticleCulling culling)
+{
+    switch (culling)
+    {
+    case ParticleCulling::NONE:      return "none";
+    case ParticleCulling::EMITTER:   return "emitter";
+    case ParticleCulling::PARTICLES: return "particles";
+    }
+    return "unknown";
+}
+
+// Six planes of a view frustum, normals pointing inside and normalized so a
+// plane gives the signed distance of a point. A default Frustum has all
+// planes zero and lets everything through.
+struct Frustum
+{
+    // left, right, bottom, top, near, far
+    glm::vec4 planes[6] = {};
+
+    // planes of projection * view (* model), Gribb/Hartmann: the clip space
+    // test -w <= x, y, z <= w written as planes on the rows of the matrix
+    static Frustum fromMatrix(const glm::mat4 &m)
+    {
+        const glm::vec4 rowX(m[0][0], m[1][0], m[2][0], m[3][0]);
+        const glm::vec4 rowY(m[0][1], m[1][1], m[2][1], m[3][1]);
+        const glm::vec4 rowZ(m[0][2], m[1][2], m[2][2], m[3][2]);
+        const glm::vec4 rowW(m[0][3], m[1][3], m[2][3], m[3][3]);
+        Frustum frustum;
+        frustum.planes[0] = rowW + rowX;
+        frustum.planes[1] = rowW - rowX;
+        frustum.planes[2] = rowW + rowY;
+        frustum.planes[3] = rowW - rowY;
+        frustum.planes[4] = rowW + rowZ;
+        frustum.planes[5] = rowW - rowZ;
+        for (glm::vec4 &plane : frustum.planes)
+        {
+            const float length = glm::length(glm::vec3(plane.x, plane.y, plane.z));
+            if (length > 0.0f)
+                plane = plane / length;
+        }
+        return frustum;
+    }
+
+    // whether a sphere of radius around position reaches inside
+    bool contains(glm::vec3 position, float radius) const
+    {
+        for (const glm::vec4 &plane : planes)
+        {
+            if (plane.x * position.x + plane.y * position.y + plane.z * position.z + plane.w < -radius)
+                return false;
+        }
+        return true;
+    }
+
+    // whether bounds grown by radius reach inside; conservative, a box near
+    // a frustum corner can pass without touching it. Empty bounds never do
+    bool intersects(const ParticleBounds &bounds, float radius) const
+    {
+        if (bounds.empty())
+            return false;
+        for (const glm::vec4 &plane : planes)
+        {
+            // the corner farthest along the normal
+            const glm::vec3 corner(plane.x >= 0.0f ? bounds.max.x : bounds.min.x,
+                                   plane.y >= 0.0f ? bounds.max.y : bounds.min.y,
+                                   plane.z >= 0.0f ? bounds.max.z : bounds.min.z);
+            if (plane.x * corner.x + plane.y * corner.y + plane.z * corner.z + plane.w < -radius)
+                return false;
+        }
+        return true;
+    }
+};
+
+// Per-particle frustum kernels. Every kernel tests the particles [begin, end)
+// as spheres of radius, positions interpolated by alpha, and writes one bit
+// per particle: bit k of visible[i / 8] is particle i, begin has to be a
+// multiple of 8 and the bits past end in the last byte are cleared. The
+// vector versions use the scalar operation order, all paths agree bit for bit.
+
+inline void cullParticlesScalar(const ParticleView &particles, float alpha, const Frustum &frustum, float radius,
+                                uint8_t *visible, std::size_t begin, std::size_t end)
+{
+    const float *x = particles.positionX.data();
+    const float *y = particles.positionY.data();
+    const float *z = particles.positionZ.data();
+    const float *px = particles.previousX.data();
+    const float *py = particles.previousY.data();
+    const float *pz = particles.previousZ.data();
+    const bool interpolate = alpha < 1.0f;
+
+    for (std::size_t base = begin; base < end; base += 8)
+    {
+        uint8_t bits = 0;
+        for (std::size_t k = 0; k < 8 && base + k < end; ++k)
+        {
+            const std::size_t i = base + k;
+            float cx = x[i], cy = y[i], cz = z[i];
+            if (interpolate)
+            {
+                cx = px[i] + (cx - px[i]) * alpha;
+                cy = py[i] + (cy - py[i]) * alpha;
+                cz = pz[i] + (cz - pz[i]) * alpha;
+            }
+            bool inside = true;
+            for (const glm::vec4 &plane : frustum.planes)
+                inside = inside && plane.x * cx + plane.y * cy + plane.z * cz + plane.w >= -radius;
+            bits |= static_cast<uint8_t>(inside) << k;
+        }
+        visible[base / 8] = bits;
+    }
+}
+
+#if defined(PARTICLE_SIMD_X86)
+
+// 4 particles per test, two tests per visibility byte, SSE2 only
+inline void cullParticlesSSE(const ParticleView &particles, float alpha, const Frustum &frustum, float radius,
+                             uint8_t *visible, std::size_t begin, std::size_t end)
+{
+    const float *x = particles.positionX.data();
+    const float *y = particles.positionY.data();
+    const float *z = particles.positionZ.data();
+    const float *px = particles.previousX.data();
+    const float *py = particles.previousY.data();
+    const float *pz = particles.previousZ.data();
+    const bool interpolate = alpha < 1.0f;
+    const __m128 va = _mm_set1_ps(alpha);
+    const __m128 limit = _mm_set1_ps(-radius);
+    __m128 nx[6], ny[6], nz[6], nw[6];
+    for (int p = 0; p < 6; ++p)
+    {
+        nx[p] = _mm_set1_ps(frustum.planes[p].x);
+        ny[p] = _mm_set1_ps(frustum.planes[p].y);
+        nz[p] = _mm_set1_ps(frustum.planes[p].z);
+        nw[p] = _mm_set1_ps(frustum.planes[p].w);
+    }
+
+    auto test = [&](std::size_t i) {
+        __m128 cx = _mm_loadu_ps(x + i);
+        __m128 cy = _mm_loadu_ps(y + i);
+        __m128 cz = _mm_loadu_ps(z + i);
+        if (interpolate)
+        {
+            const __m128 ox = _mm_loadu_ps(px + i);
+            const __m128 oy = _mm_loadu_ps(py + i);
+            const __m128 oz = _mm_loadu_ps(pz + i);
+            cx = _mm_add_ps(ox, _mm_mul_ps(_mm_sub_ps(cx, ox), va));
+            cy = _mm_add_ps(oy, _mm_mul_ps(_mm_sub_ps(cy, oy), va));
+            cz = _mm_add_ps(oz, _mm_mul_ps(_mm_sub_ps(cz, oz), va));
+        }
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; ++p)
+        {
+            __m128 d = _mm_add_ps(_mm_mul_ps(nx[p], cx), _mm_mul_ps(ny[p], cy));
+            d = _mm_add_ps(_mm_add_ps(d, _mm_mul_ps(nz[p], cz)), nw[p]);
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(d, limit));
+        }
+        return _mm_movemask_ps(inside);
+    };
+
+    std::size_t i = begin;
+    for (; i + 8 <= end; i += 8)
+        visible[i / 8] = static_cast<uint8_t>(test(i) | test(i + 4) << 4);
+    cullParticlesScalar(particles, alpha, frustum, radius, visible, i, end);
+}
+
+// 8 particles per test, one visibility byte straight from the movemask
+__attribute__((target("avx2")))
+inline void cullParticlesAVX2(const ParticleView &particles, float alpha, const Frustum &frustum, float radius,
+                              uint8_t *visible, std::size_t begin, std::size_t end)
+{
+    const float *x = particles.positionX.data();
+    const float *y = particles.positionY.data();
+    const float *z = particles.positionZ.data();
+    const float *px = particles.previousX.data();
+    const float *py = particles.previousY.data();
+    const float *pz = particles.previousZ.data();
+    const bool interpolate = alpha < 1.0f;
+    const __m256 va = _mm256_set1_ps(alpha);
+    const __m256 limit = _mm256_set1_ps(-radius);
+    __m256 nx[6], ny[6], nz[6], nw[6];
+    for (int p = 0; p < 6; ++p)
+    {
+        nx[p] = _mm256_set1_ps(frustum.planes[p].x);
+        ny[p] = _mm256_set1_ps(frustum.planes[p].y);
+        nz[p] = _mm256_set1_ps(frustum.planes[p].z);
+        nw[p] = _mm256_set1_ps(frustum.planes[p].w);
+    }
+
+    std::size_t i = begin;
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256 cx = _mm256_loadu_ps(x + i);
+        __m256 cy = _mm256_loadu_ps(y + i);
+        __m256 cz = _mm256_loadu_ps(z + i);
+        if (interpolate)
+        {
+            const __m256 ox = _mm256_loadu_ps(px + i);
+            const __m256 oy = _mm256_loadu_ps(py + i);
+            const __m256 oz = _mm256_loadu_ps(pz + i);
+            cx = _mm256_add_ps(ox, _mm256_mul_ps(_mm256_sub_ps(cx, ox), va));
+            cy = _mm256_add_ps(oy, _mm256_mul_ps(_mm256_sub_ps(cy, oy), va));
+            cz = _mm256_add_ps(oz, _mm256_mul_ps(_mm256_sub_ps(cz, oz), va));
+        }
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < 6; ++p)
+        {
+            __m256 d = _mm256_add_ps(_mm256_mul_ps(nx[p], cx), _mm256_mul_ps(ny[p], cy));
+            d = _mm256_add_ps(_mm256_add_ps(d, _mm256_mul_ps(nz[p], cz)), nw[p]);
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, limit, _CMP_GE_OQ));
+        }
+        visible[i / 8] = static_cast<uint8_t>(_mm256_movemask_ps(inside));
+    }
+    cullParticlesScalar(particles, alpha, frustum, radius, visible, i, end);
+}
+
+#endif
+
+typedef void (*CullParticlesFunction)(const ParticleView &, float, const Frustum &, float, uint8_t *, std::size_t, std::size_t);
+
+// kernel for a given path, falls back to scalar when the path isn't compiled
+// in; NEON has no cull kernel yet and takes the scalar one
+inline CullParticlesFunction getCullParticles(SimdPath path)
+{
+    switch (path)
+    {
+#if defined(PARTICLE_SIMD_X86)
+    case SimdPath::AVX2: return cullParticlesAVX2;
+    case SimdPath::SSE:  return cullParticlesSSE;
+#endif
+    default: return cullParticlesScalar;
+    }
+}
+
+// cull [begin, end) with the best kernel, picked once on first use
+inline void cullParticles(const ParticleView &particles, float alpha, const Frustum &frustum, float radius,
+                          uint8_t *visible, std::size_t begin, std::size_t end)
+{
+    static const CullParticlesFunction function = getCullParticles(detectSimdPath());
+    function(particles, alpha, frustum, radius, visible, begin, end);
+}
+
+// bit positions set in every byte value, for turning visibility bytes into indices
+struct SetBitTable
+{
+    uint8_t index[256][8] = {};
+    uint8_t count[256] = {};
+};
+
+constexpr SetBitTable makeSetBitTable()
+{
+    SetBitTable table;
+    for (int bits = 0; bits < 256; ++bits)
+    {
+        for (int k = 0; k < 8; ++k)
+        {
+            if (bits >> k & 1)
+                table.index[bits][table.count[bits]++] = static_cast<uint8_t>(k);
+        }
+    }
+    return table;
+}
+
+inline constexpr SetBitTable setBitTable = makeSetBitTable();
+
+// The alive particles inside a frustum as a compact index list, what the
+// instance buffer is then written from. One pass tests the particles into a
+// bitmask and counts every chunk, a prefix sum over the counts gives each
+// chunk its output offset, and a second pass writes the indices: all of it
+// split across the job system, and the list keeps the order it was given.
+class ParticleCuller
+{
+public:
+
+    // indices of the particles whose sphere of radius reaches into the
+    // frustum, in the given order (null: pool order); valid until the next cull
+    const std::vector<uint32_t> &cull(const ParticleView &particles, float alpha, const Frustum &frustum, float radius,
+                                      const uint32_t *order = nullptr, JobSystem *jobSystem = nullptr, std::size_t grain = 16384)
+    {
+        const std::size_t count = particles.size();
+        // whole visibility bytes per chunk, so no two chunks write the same one
+        grain = std::max<std::size_t>((grain + 7) / 8 * 8, 8);
+        const std::size_t chunks = (count + grain - 1) / grain;
+        m_visible.resize((count + 7) / 8);
+        m_offsets.assign(chunks + 1, 0);
+        uint8_t *visible = m_visible.data();
+        std::size_t *counts = m_offsets.data() + 1;
+
+        parallelForChunks(jobSystem, count, grain, [&](std::size_t chunk, std::size_t begin, std::size_t end) {
+            cullParticles(particles, alpha, frustum, radius, visible, begin, end);
+            if (order)
+                return;
+            std::size_t n = 0;
+            for (std::size_t byte = begin / 8; byte < (end + 7) / 8; ++byte)
+                n += setBitTable.count[visible[byte]];
+            counts[chunk] = n;
+        });
+        // in the given order the chunks hold other particles than they tested;
+        // gather their bits once, the write pass reads them back in sequence
+        if (order)
+        {
+            m_ordered.resize(count);
+            parallelForChunks(jobSystem, count, grain, [&](std::size_t chunk, std::size_t begin, std::size_t end) {
+                std::size_t n = 0;
+                for (std::size_t j = begin; j < end; ++j)
+                {
+                    m_ordered[j] = isVisible(visible, order[j]);
+                    n += m_ordered[j];
+                }
+                counts[chunk] = n;
+            });
+        }
+        for (std::size_t chunk = 0; chunk < chunks; ++chunk)
+            m_offsets[chunk + 1] += m_offsets[chunk];
+
+        m_indices.resize(m_offsets[chunks]);
+        parallelForChunks(jobSystem, count, grain, [&](std::size_t chunk, std::size_t begin, std::size_t end) {
+            uint32_t *out = m_indices.data() + m_offsets[chunk];
+            if (order)
+            {
+                // unconditional store, the pointer only moves past visible ones
+                uint32_t *const last = m_indices.data() + m_offsets[chunk + 1];
+                for (std::size_t j = begin; j < end && out < last; ++j)
+                {
+                    *out = order[j];
+                    out += m_ordered[j];
+                }
+                return;
+            }
+            // all eight table entries of a byte without a branch per bit, the
+            // next byte overwrites the ones past its count; only the last few
+            // bytes of a chunk, where that would run into the next chunk's
+            // indices, copy just the count
+            uint32_t *const last = m_indices.data() + m_offsets[chunk + 1];
+            for (std::size_t byte = begin / 8; byte < (end + 7) / 8; ++byte)
+            {
+                const uint8_t bits = visible[byte];
+                const uint8_t *index = setBitTable.index[bits];
+                const uint32_t base = static_cast<uint32_t>(byte * 8);
+                const int n = out + 8 <= last ? 8 : setBitTable.count[bits];
+                for (int k = 0; k < n; ++k)
+                    out[k] = base + index[k];
+                out += setBitTable.count[bits];
+            }
+        });
+        return m_indices;
+    }
+
+    const std::vector<uint32_t> &getIndices() const { return m_indices; }
+
+private:
+
+    static bool isVisible(const uint8_t *visible, uint32_t i)
+    {
+        return (visible[i / 8] >> (i % 8)) & 1;
+    }
+
+    std::vector<uint8_t> m_visible;
+    // visibility of the particles in the given order, one byte each
+    std::vector<uint8_t> m_ordered;
+    // where every chunk starts writing, the total at the end
+    std::vector<std::size_t> m_offsets;
+    std::vector<uint32_t> m_indices;
+};
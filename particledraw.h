@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+#include "particlesimulation.h"
+#include "particlesort.h"
+#include "particlecull.h"
+#include "jobsystem.h"
+
+// everything that decides which alive particles are drawn, and in which order
+struct DrawSettings
+{
+    // between the previous (0) and the last simulated step (1)
+    float alpha = 1.0f;
+    // back to front along front from eye, see DepthSorter
+    bool depthSort = false;
+    glm::vec3 eye = glm::vec3(0.0f);
+    glm::vec3 front = glm::vec3(0.0f, 0.0f, -1.0f);
+    ParticleCulling culling = ParticleCulling::NONE;
+    Frustum frustum;
+    // how far a drawn particle reaches around its position
+    float radius = 0.0f;
+};
+
+// particles to draw: order[0, count), or slots [0, count) without an order
+struct DrawList
+{
+    const uint32_t *order = nullptr;
+    std::size_t count = 0;
+    // alive particles culling left out
+    std::size_t culled = 0;
+};
+
+// Turns the state of a simulation into a DrawList: emitter cull, depth sort,
+// particle cull, in that order, so a hidden emitter costs one box test and
+// the particle cull keeps the sorted order. Shared by the synchronous Upload
+// and the SimulationThread snapshots.
+class DrawListBuilder
+{
+public:
+
+    // on the thread that owns the simulation; the list stays valid until the
+    // next build or until the simulation changes
+    DrawList build(ParticleSimulation &simulation, const DrawSettings &settings)
+    {
+        // Update keeps the bounds from now on, in the same pass as integrate
+        simulation.setTrackBounds(settings.culling != ParticleCulling::NONE);
+        const ParticleView particles = simulation.getAliveParticles();
+        JobSystem *jobSystem = simulation.getJobSystem();
+        const std::size_t grain = simulation.getGrainSize();
+
+        DrawList list;
+        list.count = particles.size();
+        if (settings.culling != ParticleCulling::NONE && list.count > 0 &&
+            !settings.frustum.intersects(simulation.getBounds(), settings.radius))
+        {
+            list.culled = list.count;
+            list.count = 0;
+            return list;
+        }
+        if (settings.depthSort)
+            list.order = m_sorter.sort(particles, settings.alpha, settings.eye, settings.front, jobSystem, grain).data();
+        if (settings.culling == ParticleCulling::PARTICLES)
+        {
+            const std::vector<uint32_t> &visible = m_culler.cull(particles, settings.alpha, settings.frustum, settings.radius,
+                                                                 list.order, jobSystem, grain);
+            list.order = visible.data();
+            list.culled = list.count - visible.size();
+            list.count = visible.size();
+        }
+        return list;
+    }
+
+    // instances of the list, positions interpolated by alpha
+    static void writeInstances(ParticleInstance *instances, const ParticleView &particles, const DrawList &list, float alpha,
+                               JobSystem *jobSystem, std::size_t grain)
+    {
+        const uint32_t *order = list.order;
+        auto write = [instances, &particles, order, alpha](std::size_t begin, std::size_t end) {
+            if (order)
+                writeSortedParticleInstances(instances, particles, order, alpha, begin, end);
+            else
+                writeParticleInstances(instances, particles, alpha, begin, end);
+        };
+        if (jobSystem)
+            jobSystem->parallelFor(0, list.count, grain, write);
+        else
+            write(0, list.count);
+    }
+
+    // how the last build ordered the particles
+    DepthSortMethod getLastSortMethod() const { return m_sorter.getLastMethod(); }
+
+private:
+
+    DepthSorter m_sorter;
+    ParticleCuller m_culler;
+};
@@ -0,0 +1,293 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#define PARTICLE_SIMD_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PARTICLE_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+#include "particlestore.h"
+
+// Update kernels for ParticleStore. Every kernel reduces life of the
+// particles in [begin, end) and moves/fades the ones that are still alive.
+// The vector versions evaluate the life > 0 test as a lane mask and blend
+// the result instead of branching per particle, and use the same operation
+// order as the scalar loop so all paths produce identical results.
+
+enum class SimdPath
+{
+    SCALAR,
+    SSE,
+    AVX2,
+    NEON
+};
+
+inline const char *simdPathName(SimdPath path)
+{
+    switch (path)
+    {
+    case SimdPath::SCALAR: return "scalar";
+    case SimdPath::SSE:    return "sse";
+    case SimdPath::AVX2:   return "avx2";
+    case SimdPath::NEON:   return "neon";
+    }
+    return "unknown";
+}
+
+inline void integrateParticlesScalar(ParticleStore &store, std::size_t begin, std::size_t end, float dt)
+{
+    float *px = store.m_positionX.data();
+    float *py = store.m_positionY.data();
+    float *pz = store.m_positionZ.data();
+    const float *vx = store.m_velocityX.data();
+    const float *vy = store.m_velocityY.data();
+    const float *vz = store.m_velocityZ.data();
+    float *alpha = store.m_colorA.data();
+    float *life = store.m_life.data();
+
+    for (std::size_t i = begin; i < end; ++i)
+    {
+        life[i] -= dt; // reduce life
+        if (life[i] > 0.0f)
+        {	// particle is alive, thus update
+            px[i] -= vx[i] * dt * 2.f;
+            py[i] -= vy[i] * dt * 2.f;
+            pz[i] -= vz[i] * dt * 2.f;
+            alpha[i] -= dt * 1.f;
+        }
+    }
+}
+
+#if defined(PARTICLE_SIMD_X86)
+
+// 4 particles per iteration, SSE2 only: mask blend is done with and/andnot/or
+inline void integrateParticlesSSE(ParticleStore &store, std::size_t begin, std::size_t end, float dt)
+{
+    float *px = store.m_positionX.data();
+    float *py = store.m_positionY.data();
+    float *pz = store.m_positionZ.data();
+    const float *vx = store.m_velocityX.data();
+    const float *vy = store.m_velocityY.data();
+    const float *vz = store.m_velocityZ.data();
+    float *alpha = store.m_colorA.data();
+    float *life = store.m_life.data();
+
+    const __m128 vdt = _mm_set1_ps(dt);
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 zero = _mm_setzero_ps();
+
+    std::size_t i = begin;
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128 l = _mm_sub_ps(_mm_loadu_ps(life + i), vdt);
+        _mm_storeu_ps(life + i, l);
+        __m128 alive = _mm_cmpgt_ps(l, zero);
+
+        __m128 x = _mm_loadu_ps(px + i);
+        __m128 y = _mm_loadu_ps(py + i);
+        __m128 z = _mm_loadu_ps(pz + i);
+        __m128 a = _mm_loadu_ps(alpha + i);
+        __m128 nx = _mm_sub_ps(x, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(vx + i), vdt), two));
+        __m128 ny = _mm_sub_ps(y, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(vy + i), vdt), two));
+        __m128 nz = _mm_sub_ps(z, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(vz + i), vdt), two));
+        __m128 na = _mm_sub_ps(a, vdt);
+
+        _mm_storeu_ps(px + i, _mm_or_ps(_mm_and_ps(alive, nx), _mm_andnot_ps(alive, x)));
+        _mm_storeu_ps(py + i, _mm_or_ps(_mm_and_ps(alive, ny), _mm_andnot_ps(alive, y)));
+        _mm_storeu_ps(pz + i, _mm_or_ps(_mm_and_ps(alive, nz), _mm_andnot_ps(alive, z)));
+        _mm_storeu_ps(alpha + i, _mm_or_ps(_mm_and_ps(alive, na), _mm_andnot_ps(alive, a)));
+    }
+    integrateParticlesScalar(store, i, end, dt);
+}
+
+// 8 particles per iteration, compiled for AVX2 regardless of the global flags
+__attribute__((target("avx2")))
+inline void integrateParticlesAVX2(ParticleStore &store, std::size_t begin, std::size_t end, float dt)
+{
+    float *px = store.m_positionX.data();
+    float *py = store.m_positionY.data();
+    float *pz = store.m_positionZ.data();
+    const float *vx = store.m_velocityX.data();
+    const float *vy = store.m_velocityY.data();
+    const float *vz = store.m_velocityZ.data();
+    float *alpha = store.m_colorA.data();
+    float *life = store.m_life.data();
+
+    const __m256 vdt = _mm256_set1_ps(dt);
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 zero = _mm256_setzero_ps();
+
+    std::size_t i = begin;
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256 l = _mm256_sub_ps(_mm256_loadu_ps(life + i), vdt);
+        _mm256_storeu_ps(life + i, l);
+        __m256 alive = _mm256_cmp_ps(l, zero, _CMP_GT_OQ);
+
+        __m256 x = _mm256_loadu_ps(px + i);
+        __m256 y = _mm256_loadu_ps(py + i);
+        __m256 z = _mm256_loadu_ps(pz + i);
+        __m256 a = _mm256_loadu_ps(alpha + i);
+        __m256 nx = _mm256_sub_ps(x, _mm256_mul_ps(_mm256_mul_ps(_mm256_loadu_ps(vx + i), vdt), two));
+        __m256 ny = _mm256_sub_ps(y, _mm256_mul_ps(_mm256_mul_ps(_mm256_loadu_ps(vy + i), vdt), two));
+        __m256 nz = _mm256_sub_ps(z, _mm256_mul_ps(_mm256_mul_ps(_mm256_loadu_ps(vz + i), vdt), two));
+        __m256 na = _mm256_sub_ps(a, vdt);
+
+        _mm256_storeu_ps(px + i, _mm256_blendv_ps(x, nx, alive));
+        _mm256_storeu_ps(py + i, _mm256_blendv_ps(y, ny, alive));
+        _mm256_storeu_ps(pz + i, _mm256_blendv_ps(z, nz, alive));
+        _mm256_storeu_ps(alpha + i, _mm256_blendv_ps(a, na, alive));
+    }
+    integrateParticlesScalar(store, i, end, dt);
+}
+
+#elif defined(PARTICLE_SIMD_NEON)
+
+// 4 particles per iteration
+inline void integrateParticlesNEON(ParticleStore &store, std::size_t begin, std::size_t end, float dt)
+{
+    float *px = store.m_positionX.data();
+    float *py = store.m_positionY.data();
+    float *pz = store.m_positionZ.data();
+    const float *vx = store.m_velocityX.data();
+    const float *vy = store.m_velocityY.data();
+    const float *vz = store.m_velocityZ.data();
+    float *alpha = store.m_colorA.data();
+    float *life = store.m_life.data();
+
+    const float32x4_t vdt = vdupq_n_f32(dt);
+    const float32x4_t two = vdupq_n_f32(2.0f);
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+
+    std::size_t i = begin;
+    for (; i + 4 <= end; i += 4)
+    {
+        float32x4_t l = vsubq_f32(vld1q_f32(life + i), vdt);
+        vst1q_f32(life + i, l);
+        uint32x4_t alive = vcgtq_f32(l, zero);
+
+        float32x4_t x = vld1q_f32(px + i);
+        float32x4_t y = vld1q_f32(py + i);
+        float32x4_t z = vld1q_f32(pz + i);
+        float32x4_t a = vld1q_f32(alpha + i);
+        float32x4_t nx = vsubq_f32(x, vmulq_f32(vmulq_f32(vld1q_f32(vx + i), vdt), two));
+        float32x4_t ny = vsubq_f32(y, vmulq_f32(vmulq_f32(vld1q_f32(vy + i), vdt), two));
+        float32x4_t nz = vsubq_f32(z, vmulq_f32(vmulq_f32(vld1q_f32(vz + i), vdt), two));
+        float32x4_t na = vsubq_f32(a, vdt);
+
+        vst1q_f32(px + i, vbslq_f32(alive, nx, x));
+        vst1q_f32(py + i, vbslq_f32(alive, ny, y));
+        vst1q_f32(pz + i, vbslq_f32(alive, nz, z));
+        vst1q_f32(alpha + i, vbslq_f32(alive, na, a));
+    }
+    integrateParticlesScalar(store, i, end, dt);
+}
+
+#endif
+
+// widest path the running CPU supports
+inline SimdPath detectSimdPath()
+{
+#if defined(PARTICLE_SIMD_X86)
+    if (__builtin_cpu_supports("avx2"))
+        return SimdPath::AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SimdPath::SSE;
+    return SimdPath::SCALAR;
+#elif defined(PARTICLE_SIMD_NEON)
+    return SimdPath::NEON;
+#else
+    return SimdPath::SCALAR;
+#endif
+}
+
+typedef void (*IntegrateParticlesFunction)(ParticleStore &, std::size_t, std::size_t, float);
+
+// kernel for a given path, falls back to scalar when the path isn't compiled in
+inline IntegrateParticlesFunction getIntegrateParticles(SimdPath path)
+{
+    switch (path)
+    {
+#if defined(PARTICLE_SIMD_X86)
+    case SimdPath::AVX2: return integrateParticlesAVX2;
+    case SimdPath::SSE:  return integrateParticlesSSE;
+#elif defined(PARTICLE_SIMD_NEON)
+    case SimdPath::NEON: return integrateParticlesNEON;
+#endif
+    default: return integrateParticlesScalar;
+    }
+}
+
+// update [begin, end) with the best kernel, picked once on first use
+inline void integrateParticles(ParticleStore &store, std::size_t begin, std::size_t end, float dt)
+{
+    static const IntegrateParticlesFunction function = getIntegrateParticles(detectSimdPath());
+    function(store, begin, end, dt);
+}
+
+inline void integrateParticles(ParticleStore &store, float dt)
+{
+    integrateParticles(store, 0, store.size(), dt);
+}
+
+// min/max of values [begin, end) into lo/hi. A float min/max reduction
+// only auto-vectorizes with -ffast-math, so the x86 loop is spelled out,
+// with four accumulators each to hide the minps/maxps latency
+inline void extendRange(const float *values, std::size_t begin, std::size_t end, float &lo, float &hi)
+{
+    std::size_t i = begin;
+#if defined(PARTICLE_SIMD_X86)
+    if (end - begin >= 16)
+    {
+        __m128 lo0 = _mm_set1_ps(lo), lo1 = lo0, lo2 = lo0, lo3 = lo0;
+        __m128 hi0 = _mm_set1_ps(hi), hi1 = hi0, hi2 = hi0, hi3 = hi0;
+        for (; i + 16 <= end; i += 16)
+        {
+            const __m128 v0 = _mm_loadu_ps(values + i);
+            const __m128 v1 = _mm_loadu_ps(values + i + 4);
+            const __m128 v2 = _mm_loadu_ps(values + i + 8);
+            const __m128 v3 = _mm_loadu_ps(values + i + 12);
+            lo0 = _mm_min_ps(lo0, v0);
+            lo1 = _mm_min_ps(lo1, v1);
+            lo2 = _mm_min_ps(lo2, v2);
+            lo3 = _mm_min_ps(lo3, v3);
+            hi0 = _mm_max_ps(hi0, v0);
+            hi1 = _mm_max_ps(hi1, v1);
+            hi2 = _mm_max_ps(hi2, v2);
+            hi3 = _mm_max_ps(hi3, v3);
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, _mm_min_ps(_mm_min_ps(lo0, lo1), _mm_min_ps(lo2, lo3)));
+        lo = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+        _mm_storeu_ps(lanes, _mm_max_ps(_mm_max_ps(hi0, hi1), _mm_max_ps(hi2, hi3)));
+        hi = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    }
+#endif
+    for (; i < end; ++i)
+    {
+        lo = std::min(lo, values[i]);
+        hi = std::max(hi, values[i]);
+    }
+}
+
+// box around the positions of [begin, end), and around the previous ones
+// too if asked, so every interpolated position lies inside
+inline ParticleBounds computeBounds(const ParticleStore &store, std::size_t begin, std::size_t end, bool withPrevious = false)
+{
+    ParticleBounds bounds;
+    extendRange(store.m_positionX.data(), begin, end, bounds.min.x, bounds.max.x);
+    extendRange(store.m_positionY.data(), begin, end, bounds.min.y, bounds.max.y);
+    extendRange(store.m_positionZ.data(), begin, end, bounds.min.z, bounds.max.z);
+    if (withPrevious)
+    {
+        extendRange(store.m_previousX.data(), begin, end, bounds.min.x, bounds.max.x);
+        extendRange(store.m_previousY.data(), begin, end, bounds.min.y, bounds.max.y);
+        extendRange(store.m_previousZ.data(), begin, end, bounds.min.z, bounds.max.z);
+    }
+    return bounds;
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "particlekernels.h"
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel Random
+// Numbers: As Easy as 1, 2, 3"). A block of four 32-bit words is a pure
+// function of (seed, stream, index), so there is no state to share or lock:
+// any thread can generate any part of a stream, and a batch filled in
+// parallel chunks is bit-identical to the same batch filled in one go, on
+// every platform.
+//
+// Uniform floats are the top 24 bits of a word scaled by 2^-24, exact in
+// both the scalar and the vector path, so [0, 1) never rounds up to 1.
+
+namespace philox
+{
+
+static const uint32_t multiplier0 = 0xD2511F53;
+static const uint32_t multiplier1 = 0xCD9E8D57;
+static const uint32_t weyl0 = 0x9E3779B9;
+static const uint32_t weyl1 = 0xBB67AE85;
+static const int rounds = 10;
+
+inline float toUniform(uint32_t word)
+{
+    return static_cast<float>(word >> 8) * (1.0f / 16777216.0f);
+}
+
+// counter = (index, stream), key = seed
+inline void block(uint64_t seed, uint64_t stream, uint64_t index, uint32_t out[4])
+{
+    uint32_t c0 = static_cast<uint32_t>(index), c1 = static_cast<uint32_t>(index >> 32);
+    uint32_t c2 = static_cast<uint32_t>(stream), c3 = static_cast<uint32_t>(stream >> 32);
+    uint32_t k0 = static_cast<uint32_t>(seed), k1 = static_cast<uint32_t>(seed >> 32);
+    for (int round = 0; round < rounds; ++round)
+    {
+        const uint64_t product0 = static_cast<uint64_t>(multiplier0) * c0;
+        const uint64_t product1 = static_cast<uint64_t>(multiplier1) * c2;
+        const uint32_t n0 = static_cast<uint32_t>(product1 >> 32) ^ c1 ^ k0;
+        const uint32_t n2 = static_cast<uint32_t>(product0 >> 32) ^ c3 ^ k1;
+        c1 = static_cast<uint32_t>(product1);
+        c3 = static_cast<uint32_t>(product0);
+        c0 = n0;
+        c2 = n2;
+        k0 += weyl0;
+        k1 += weyl1;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+// out[4 * b + w] = uniform of word w of block firstBlock + b, for b < blocks
+inline void fillBlocksScalar(float *out, std::size_t blocks, uint64_t seed, uint64_t stream, uint64_t firstBlock)
+{
+    for (std::size_t b = 0; b < blocks; ++b)
+    {
+        uint32_t words[4];
+        block(seed, stream, firstBlock + b, words);
+        for (int w = 0; w < 4; ++w)
+            out[4 * b + w] = toUniform(words[w]);
+    }
+}
+
+#if defined(PARTICLE_SIMD_X86)
+
+// high and low 32 bits of the eight 32x32 bit products a * m
+__attribute__((target("avx2")))
+inline void mulhilo8(__m256i a, __m256i m, __m256i &hi, __m256i &lo)
+{
+    const __m256i even = _mm256_mul_epu32(a, m);
+    const __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m);
+    lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+    hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+}
+
+// eight blocks per iteration, one per lane, transposed back to block order
+__attribute__((target("avx2")))
+inline void fillBlocksAVX2(float *out, std::size_t blocks, uint64_t seed, uint64_t stream, uint64_t firstBlock)
+{
+    const __m256i m0 = _mm256_set1_epi32(static_cast<int>(multiplier0));
+    const __m256i m1 = _mm256_set1_epi32(static_cast<int>(multiplier1));
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 scale = _mm256_set1_ps(1.0f / 16777216.0f);
+    std::size_t b = 0;
+    for (; b + 8 <= blocks; b += 8)
+    {
+        const uint64_t index = firstBlock + b;
+        // the low index word carries into the high one within these eight blocks
+        const __m256i low = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(static_cast<uint32_t>(index))), lane);
+        const __m256i carry = _mm256_cmpgt_epi32(_mm256_xor_si256(_mm256_set1_epi32(static_cast<int>(static_cast<uint32_t>(index))), _mm256_set1_epi32(INT32_MIN)),
+                                                 _mm256_xor_si256(low, _mm256_set1_epi32(INT32_MIN)));
+        __m256i c0 = low;
+        __m256i c1 = _mm256_sub_epi32(_mm256_set1_epi32(static_cast<int>(static_cast<uint32_t>(index >> 32))), carry);
+        __m256i c2 = _mm256_set1_epi32(static_cast<int>(static_cast<uint32_t>(stream)));
+        __m256i c3 = _mm256_set1_epi32(static_cast<int>(static_cast<uint32_t>(stream >> 32)));
+        uint32_t k0 = static_cast<uint32_t>(seed), k1 = static_cast<uint32_t>(seed >> 32);
+        for (int round = 0; round < rounds; ++round)
+        {
+            __m256i hi0, lo0, hi1, lo1;
+            mulhilo8(c0, m0, hi0, lo0);
+            mulhilo8(c2, m1, hi1, lo1);
+            c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32(static_cast<int>(k0)));
+            c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32(static_cast<int>(k1)));
+            c1 = lo1;
+            c3 = lo0;
+            k0 += weyl0;
+            k1 += weyl1;
+        }
+        // words of blocks 0-7 in c0..c3 -> four words per block, blocks in order
+        const __m256i t0 = _mm256_unpacklo_epi32(c0, c1);
+        const __m256i t1 = _mm256_unpacklo_epi32(c2, c3);
+        const __m256i t2 = _mm256_unpackhi_epi32(c0, c1);
+        const __m256i t3 = _mm256_unpackhi_epi32(c2, c3);
+        const __m256i b04 = _mm256_unpacklo_epi64(t0, t1);
+        const __m256i b15 = _mm256_unpackhi_epi64(t0, t1);
+        const __m256i b26 = _mm256_unpacklo_epi64(t2, t3);
+        const __m256i b37 = _mm256_unpackhi_epi64(t2, t3);
+        const __m256i words[4] = {
+            _mm256_permute2x128_si256(b04, b15, 0x20),
+            _mm256_permute2x128_si256(b26, b37, 0x20),
+            _mm256_permute2x128_si256(b04, b15, 0x31),
+            _mm256_permute2x128_si256(b26, b37, 0x31)
+        };
+        for (int i = 0; i < 4; ++i)
+        {
+            const __m256 uniform = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(words[i], 8)), scale);
+            _mm256_storeu_ps(out + 4 * b + 8 * i, uniform);
+        }
+    }
+    fillBlocksScalar(out + 4 * b, blocks - b, seed, stream, firstBlock + b);
+}
+
+#endif
+
+typedef void (*FillBlocksFunction)(float *, std::size_t, uint64_t, uint64_t, uint64_t);
+
+// fill for a given path, scalar unless the path has its own version
+inline FillBlocksFunction getFillBlocks(SimdPath path)
+{
+#if defined(PARTICLE_SIMD_X86)
+    if (path == SimdPath::AVX2)
+        return fillBlocksAVX2;
+#endif
+    return fillBlocksScalar;
+}
+
+}
+
+class ParticleRandom
+{
+public:
+
+    static const uint64_t defaultSeed = 0x5EED5EED5EED5EEDull;
+
+    explicit ParticleRandom(uint64_t seed = defaultSeed) : m_seed(seed) {}
+
+    void setSeed(uint64_t seed) { m_seed = seed; }
+    uint64_t getSeed() const { return m_seed; }
+
+    // uniform float number i of stream, in [0, 1)
+    float uniform(uint64_t stream, uint64_t i) const
+    {
+        uint32_t words[4];
+        philox::block(m_seed, stream, i / 4, words);
+        return philox::toUniform(words[i % 4]);
+    }
+
+    // the four uniforms 4 * block .. 4 * block + 3 of stream from one block
+    void uniform4(uint64_t stream, uint64_t block, float out[4]) const
+    {
+        uint32_t words[4];
+        philox::block(m_seed, stream, block, words);
+        for (int w = 0; w < 4; ++w)
+            out[w] = philox::toUniform(words[w]);
+    }
+
+    // out[j] = uniform(stream, first + j) for j < count, whole blocks go
+    // through the widest vector path the CPU has
+    void fillUniform(float *out, std::size_t count, uint64_t stream, uint64_t first = 0) const
+    {
+        static const philox::FillBlocksFunction fillBlocks = philox::getFillBlocks(detectSimdPath());
+        std::size_t j = 0;
+        for (; j < count && (first + j) % 4 != 0; ++j)
+            out[j] = uniform(stream, first + j);
+        const std::size_t blocks = (count - j) / 4;
+        fillBlocks(out + j, blocks, m_seed, stream, (first + j) / 4);
+        for (j += 4 * blocks; j < count; ++j)
+            out[j] = uniform(stream, first + j);
+    }
+
+private:
+
+    uint64_t m_seed;
+};
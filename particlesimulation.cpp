@@ -0,0 +1,161 @@
+#include "particlesimulation.h"
+
+#include <cmath>
+
+ParticleSimulation::ParticleSimulation(unsigned int amount) :
+    m_particles(amount), m_amount(amount) {
+}
+
+ParticleView ParticleSimulation::getAliveParticles() const {
+    const std::size_t count = m_particles.aliveCount();
+    auto alive = [count](const AlignedVector<float> &array) {
+        return std::span<const float>(array.data(), count);
+    };
+    ParticleView view;
+    view.positionX = alive(m_particles.m_positionX);
+    view.positionY = alive(m_particles.m_positionY);
+    view.positionZ = alive(m_particles.m_positionZ);
+    view.previousX = alive(m_particles.m_previousX);
+    view.previousY = alive(m_particles.m_previousY);
+    view.previousZ = alive(m_particles.m_previousZ);
+    view.velocityX = alive(m_particles.m_velocityX);
+    view.velocityY = alive(m_particles.m_velocityY);
+    view.velocityZ = alive(m_particles.m_velocityZ);
+    view.colorR = alive(m_particles.m_colorR);
+    view.colorG = alive(m_particles.m_colorG);
+    view.colorB = alive(m_particles.m_colorB);
+    view.colorA = alive(m_particles.m_colorA);
+    view.life = alive(m_particles.m_life);
+    view.rotate = alive(m_particles.m_rotate);
+    view.sprite = alive(m_particles.m_sprite);
+    return view;
+}
+
+void ParticleSimulation::Update(float dt, unsigned int newParticles, glm::vec3 offset){
+
+/*    for (unsigned int i = 0; i < newParticles; i++)
+    {
+        int unusedParticle = firstUnusedParticle();
+        respawnParticle(unusedParticle, 0, glm::vec3(1,1,1), glm::vec3(1,1,1), 60, offset);
+    }*/
+
+
+    const unsigned int count = newParticles < m_amount ? newParticles : m_amount;
+    // the first count slots keep raining; top them up with fresh (dead) particles
+    while (m_particles.aliveCount() < count)
+        m_particles.spawn();
+
+    // the state before this step, what rendering interpolates from
+    const std::size_t previousCount = m_particles.aliveCount();
+    if (m_interpolated && m_jobSystem)
+    {
+        m_jobSystem->parallelFor(0, previousCount, m_grainSize, [this](std::size_t begin, std::size_t end) {
+            m_particles.savePositions(begin, end);
+        });
+    }
+    else if (m_interpolated)
+    {
+        m_particles.savePositions(0, previousCount);
+    }
+
+    // one stream per frame, one block of it per rain slot
+    const uint64_t stream = m_frame++;
+    float *life = m_particles.m_life.data();
+    float *positionY = m_particles.m_positionY.data();
+    for (unsigned int i = 0; i < count; ++i) {
+        life[i] -= dt;
+
+        // if the lifetime is below 0 respawn the particle
+        if ( life[i] <= 0.0f )
+        {
+            float uniforms[4];
+            m_random.uniform4(stream, i, uniforms);
+            m_particles.setPosition(i, glm::vec3( 0,std::floor(uniforms[0] * 50.0f),0));
+            // a respawn is a jump, not a move: don't interpolate across it
+            m_particles.savePositions(i, i + 1);
+            life[i] = std::floor(uniforms[1] * 10.0f);
+        }
+
+        // move the particle down depending on the delta time
+        positionY[i] -= dt*2.0f;
+
+     //    lastUsedParticle = i;
+
+
+    }
+
+    // update all alive particles, chunk by chunk so the bounds of a chunk
+    // come from positions that were just written
+    const std::size_t aliveCount = m_particles.aliveCount();
+    if (m_trackBounds)
+        m_chunkBounds.assign(aliveCount / m_grainSize + 1, ParticleBounds());
+    parallelForChunks(m_jobSystem, aliveCount, m_grainSize, [this, dt](std::size_t chunk, std::size_t begin, std::size_t end) {
+        integrateParticles(m_particles, begin, end, dt);
+        if (m_trackBounds)
+            m_chunkBounds[chunk] = computeBounds(m_particles, begin, end, m_interpolated);
+    });
+
+    // move the ones that just died behind the alive range; they stay in the
+    // bounds until the next step, which only makes them a little larger
+    m_particles.removeDead();
+    if (m_trackBounds)
+        mergeChunkBounds();
+    m_boundsValid = m_trackBounds;
+}
+
+const ParticleBounds &ParticleSimulation::getBounds() {
+    if (m_boundsValid)
+        return m_bounds;
+
+    const std::size_t aliveCount = m_particles.aliveCount();
+    m_chunkBounds.assign(aliveCount / m_grainSize + 1, ParticleBounds());
+    parallelForChunks(m_jobSystem, aliveCount, m_grainSize, [this](std::size_t chunk, std::size_t begin, std::size_t end) {
+        m_chunkBounds[chunk] = computeBounds(m_particles, begin, end, m_interpolated);
+    });
+    mergeChunkBounds();
+    m_boundsValid = true;
+    return m_bounds;
+}
+
+void ParticleSimulation::mergeChunkBounds() {
+    m_bounds = ParticleBounds();
+    for (const ParticleBounds &bounds : m_chunkBounds)
+        m_bounds.merge(bounds);
+}
+
+void ParticleSimulation::AddParticles(short int type, glm::vec3 position, glm::vec3 velocity, float rotation, unsigned int newParticles, glm::vec3 offset) {
+    spawnParticles(type, position, velocity, rotation, newParticles, offset);
+}
+
+ParticleRange ParticleSimulation::spawnParticles(short int type, glm::vec3 position, glm::vec3 velocity, float rotation, unsigned int newParticles, glm::vec3 offset) {
+    // the whole batch is one range of dead slots, every attribute is a single fill
+    m_boundsValid = false;
+    ParticleRange range = m_particles.spawnRange(newParticles);
+    ParticleStore::fillRange(m_particles.m_life, range, 1.f);
+    ParticleStore::fillRange(m_particles.m_velocityX, range, 0.01f);
+    ParticleStore::fillRange(m_particles.m_velocityY, range, 0.01f);
+    ParticleStore::fillRange(m_particles.m_velocityZ, range, 0.01f);
+    ParticleStore::fillRange(m_particles.m_sprite, range, static_cast<float>(type));
+
+    // all particles are taken, override the first one like firstUnusedParticle does
+    if (range.size() < newParticles && m_particles.size() > 0)
+        respawnParticle(0, type, position, velocity, rotation, offset);
+    return range;
+}
+
+unsigned int ParticleSimulation::firstUnusedParticle()
+{
+    // dead particles are kept in [aliveCount, amount), the first of them is free
+    m_boundsValid = false;
+    if (!m_particles.full())
+        return static_cast<unsigned int>(m_particles.spawn());
+    // all particles are taken, override the first one (note that if it repeatedly hits this case, more particles should be reserved)
+    return 0;
+}
+
+void ParticleSimulation::respawnParticle(unsigned int index, short int type, glm::vec3 position, glm::vec3 velocity, float rotation, glm::vec3 offset){
+    m_particles.m_life[index] = 1.f;
+    m_particles.m_sprite[index] = static_cast<float>(type);
+   // particle.m_rotate = rotation;*/
+    m_particles.setVelocity(index, glm::vec3(0.01f,0.01f, 0.01f));
+}
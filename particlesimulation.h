@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "particlestore.h"
+#include "particlekernels.h"
+#include "particlerandom.h"
+#include "jobsystem.h"
+
+// Read-only view of the alive particles, one span per ParticleStore array.
+// Valid until the next Update or AddParticles.
+struct ParticleView
+{
+    std::span<const float> positionX, positionY, positionZ;
+    std::span<const float> previousX, previousY, previousZ;
+    std::span<const float> velocityX, velocityY, velocityZ;
+    std::span<const float> colorR, colorG, colorB, colorA;
+    std::span<const float> life;
+    std::span<const float> rotate;
+    std::span<const float> sprite;
+
+    std::size_t size() const { return life.size(); }
+
+    glm::vec3 getPosition(std::size_t i) const
+    {
+        return glm::vec3(positionX[i], positionY[i], positionZ[i]);
+    }
+
+    // position between the previous (alpha 0) and the current step (alpha 1),
+    // needs ParticleSimulation::setInterpolated
+    glm::vec3 getPosition(std::size_t i, float alpha) const
+    {
+        const glm::vec3 previous(previousX[i], previousY[i], previousZ[i]);
+        return previous + (getPosition(i) - previous) * alpha;
+    }
+
+    glm::vec4 getColor(std::size_t i) const
+    {
+        return glm::vec4(colorR[i], colorG[i], colorB[i], colorA[i]);
+    }
+};
+
+// per-instance data uploaded to the instance VBO, matches attributes 1 to 3 in shaderVertex
+struct ParticleInstance {
+    glm::vec3 m_position;
+    glm::vec4 m_color;
+    // index into the spriteRects uniform
+    float m_sprite;
+};
+
+// instances [begin, end) of the view, positions interpolated by alpha
+inline void writeParticleInstances(ParticleInstance *instances, const ParticleView &particles, float alpha, std::size_t begin, std::size_t end)
+{
+    for (std::size_t i = begin; i < end; ++i)
+    {
+        instances[i].m_position = particles.getPosition(i, alpha);
+        instances[i].m_color = particles.getColor(i);
+        instances[i].m_sprite = particles.sprite[i];
+    }
+}
+
+// CPU side of ParticleSystem without any GL, built as the particle_core
+// library: the particle pool, the rain loop and spawning. ParticleSystem
+// renders it through getAliveParticles(); particle_bench and GL-less hosts
+// (effect baking, a dedicated simulation thread) use it on its own.
+class ParticleSimulation
+{
+public:
+
+    ParticleSimulation() {}
+    explicit ParticleSimulation(unsigned int amount);
+
+    // advance alive particles by dt, the first newParticles slots keep raining
+    void Update(float dt, unsigned int newParticles, glm::vec3 offset);
+    void AddParticles(short int type, glm::vec3 position, glm::vec3 velocity, float rotation, unsigned int newParticles, glm::vec3 offset);
+    // spawn newParticles in one contiguous range and return it for the caller
+    // to post-process; a full pool recycles slot 0 like firstUnusedParticle.
+    // type is the atlas sprite the particles are drawn with
+    ParticleRange spawnParticles(short int type, glm::vec3 position, glm::vec3 velocity, float rotation, unsigned int newParticles, glm::vec3 offset);
+
+    // index of a free slot, slot 0 when the pool is full
+    unsigned int firstUnusedParticle();
+    void respawnParticle(unsigned int index, short type, glm::vec3 position, glm::vec3 velocity, float rotation, glm::vec3 offset = glm::vec3(0.0f, 0.0f, 0.0f));
+
+    ParticleView getAliveParticles() const;
+    std::size_t getAliveCount() const { return m_particles.aliveCount(); }
+
+    const ParticleStore &getParticles() const { return m_particles; }
+    // writable access may move particles, getBounds recomputes afterwards
+    ParticleStore &getParticles() { m_boundsValid = false; return m_particles; }
+    unsigned int getAmount() const { return m_amount; }
+
+    // run Update on the given pool (nullptr: on the calling thread only), split
+    // into chunks of grainSize particles rounded up to whole cache lines
+    void setJobSystem(JobSystem *jobSystem) { m_jobSystem = jobSystem; }
+    JobSystem *getJobSystem() const { return m_jobSystem; }
+    void setGrainSize(std::size_t grainSize) {
+        const std::size_t line = ParticleStore::cacheLineFloats;
+        m_grainSize = grainSize < line ? line : (grainSize + line - 1) / line * line;
+    }
+    std::size_t getGrainSize() const { return m_grainSize; }
+
+    // keep the positions from before each Update for ParticleView::getPosition(i, alpha),
+    // off by default as it copies every position once more per step
+    void setInterpolated(bool interpolated) {
+        if (interpolated && !m_interpolated)
+            m_particles.savePositions(0, m_particles.aliveCount());
+        m_interpolated = interpolated;
+    }
+    bool isInterpolated() const { return m_interpolated; }
+
+    // box around every alive particle (and its previous position when
+    // interpolated), for culling the emitter as a whole. With tracking on
+    // Update computes it per chunk while the positions are still in cache;
+    // otherwise, or after spawns, getBounds takes one more pass over them
+    void setTrackBounds(bool track) { m_trackBounds = track; }
+    bool isTrackingBounds() const { return m_trackBounds; }
+    const ParticleBounds &getBounds();
+
+    // restart the random sequence, the same seed and calls replay bit for bit
+    void setSeed(uint64_t seed) { m_random.setSeed(seed); m_frame = 0; }
+    uint64_t getSeed() const { return m_random.getSeed(); }
+
+private:
+
+    ParticleStore m_particles;
+    unsigned int m_amount = 0;
+    JobSystem *m_jobSystem = nullptr;
+    std::size_t m_grainSize = 16384;
+    bool m_interpolated = false;
+    bool m_trackBounds = false;
+    bool m_boundsValid = false;
+    ParticleBounds m_bounds;
+    // one box per grain sized chunk, merged into m_bounds
+    std::vector<ParticleBounds> m_chunkBounds;
+
+    void mergeChunkBounds();
+
+    ParticleRandom m_random;
+    // random stream of the next Update
+    uint64_t m_frame = 0;
+};
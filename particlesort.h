@@ -0,0 +1,323 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "particlesimulation.h"
+#include "jobsystem.h"
+
+// how the last DepthSorter::sort got its order
+enum class DepthSortMethod
+{
+    UNCHANGED,  // last frame's order was still sorted
+    INSERTION,  // a few particles moved, fixed up in place
+    RADIX       // full radix sort
+};
+
+inline const char *depthSortMethodName(DepthSortMethod method)
+{
+    switch (method)
+    {
+    case DepthSortMethod::UNCHANGED: return "unchanged";
+    case DepthSortMethod::INSERTION: return "insertion";
+    case DepthSortMethod::RADIX:     return "radix";
+    }
+    return "unknown";
+}
+
+// Back-to-front order of the alive particles for alpha blending.
+//
+// The view depth of every particle is quantized to a 16-bit key (farthest
+// first), and the (key, index) pairs are sorted with a two-pass LSD radix
+// sort: per-chunk histograms, then one stable scatter per byte, every pass
+// split across the job system. That is O(N) whatever the order.
+//
+// Particles barely move between frames, and the sort leans on that twice.
+// The keys are quantized against last frame's depth range (plus a margin), so
+// depth and key come out of one pass over the positions; only when the
+// particles leave that range is the pass redone with a new one. And the keys
+// are laid out in last frame's order: if that is still sorted nothing moves
+// at all, and if only a few neighbours swapped places a bounded insertion
+// sort fixes them up in place; only past that budget it radix sorts.
+class DepthSorter
+{
+public:
+
+    // sort the particles by their distance along front from eye, positions
+    // interpolated by alpha; the order stays valid until the next sort
+    const std::vector<uint32_t> &sort(const ParticleView &particles, float alpha, glm::vec3 eye, glm::vec3 front,
+                                      JobSystem *jobSystem = nullptr, std::size_t grain = 16384)
+    {
+        const std::size_t count = particles.size();
+        carryOrder(count);
+        m_keys.resize(count);
+        if (count < 2)
+        {
+            m_method = DepthSortMethod::UNCHANGED;
+            return m_order;
+        }
+
+        grain = std::max<std::size_t>(grain, 1);
+        const std::size_t chunks = (count + grain - 1) / grain;
+        m_slotKeys.resize(count);
+
+        // quantized view depth of every slot, in pool order so the positions
+        // stream in; the key range is last frame's, redone if it doesn't fit
+        for (int attempt = 0; attempt < 2; ++attempt)
+        {
+            m_chunks.assign(chunks, Chunk());
+            parallelForChunks(jobSystem, count, grain, [&](std::size_t chunk, std::size_t begin, std::size_t end) {
+                Chunk &c = m_chunks[chunk];
+                computeKeys(particles, alpha, eye, front, m_rangeMin, m_scale, begin, end,
+                            m_slotKeys.data(), c.minDepth, c.maxDepth);
+            });
+            float minDepth = std::numeric_limits<float>::max();
+            float maxDepth = std::numeric_limits<float>::lowest();
+            for (const Chunk &c : m_chunks)
+            {
+                minDepth = std::min(minDepth, c.minDepth);
+                maxDepth = std::max(maxDepth, c.maxDepth);
+            }
+            // keys clamp outside the range, and a range much wider than the
+            // particles wastes precision
+            const bool fits = m_scale > 0.0f && minDepth >= m_rangeMin && maxDepth <= m_rangeMax &&
+                              m_rangeMax - m_rangeMin <= 2.0f * (maxDepth - minDepth + 2.0f * minimumMargin);
+            if (fits)
+                break;
+            const float margin = (maxDepth - minDepth) / 16.0f + minimumMargin;
+            m_rangeMin = minDepth - margin;
+            m_rangeMax = maxDepth + margin;
+            m_scale = static_cast<float>(maxKey) / (m_rangeMax - m_rangeMin);
+        }
+
+        // keys in last frame's order; histogram the low byte and count the
+        // places where that order is now wrong
+        parallelForChunks(jobSystem, count, grain, [&](std::size_t chunk, std::size_t begin, std::size_t end) {
+            const uint16_t *slotKeys = m_slotKeys.data();
+            const uint32_t *order = m_order.data();
+            uint16_t *keys = m_keys.data();
+            uint32_t *histogram = m_chunks[chunk].histogram;
+            std::size_t descents = 0;
+            for (std::size_t j = begin; j < end; ++j)
+            {
+                if (j + prefetchDistance < end)
+                    __builtin_prefetch(slotKeys + order[j + prefetchDistance]);
+                const uint16_t key = slotKeys[order[j]];
+                keys[j] = key;
+                ++histogram[key & 0xFF];
+                descents += j > begin && key < keys[j - 1];
+            }
+            m_chunks[chunk].descents = descents;
+        });
+        std::size_t descents = 0;
+        for (std::size_t chunk = 0; chunk < chunks; ++chunk)
+        {
+            descents += m_chunks[chunk].descents;
+            // the pair across the chunk boundary
+            if (chunk > 0)
+                descents += m_keys[chunk * grain] < m_keys[chunk * grain - 1];
+        }
+
+        if (descents == 0)
+        {
+            m_method = DepthSortMethod::UNCHANGED;
+            return m_order;
+        }
+        if (descents <= count / insertionDescentRatio)
+        {
+            if (insertionSort(count))
+            {
+                m_method = DepthSortMethod::INSERTION;
+                return m_order;
+            }
+            // it gave up halfway, keys moved across chunks
+            buildHistograms(jobSystem, count, grain, 0);
+        }
+        radixSort(jobSystem, count, grain);
+        m_method = DepthSortMethod::RADIX;
+        return m_order;
+    }
+
+    // forget last frame's order, the next sort starts from pool order
+    void reset() { m_order.clear(); }
+
+    const std::vector<uint32_t> &getOrder() const { return m_order; }
+    DepthSortMethod getLastMethod() const { return m_method; }
+
+private:
+
+    static const uint32_t maxKey = 0xFFFF;
+    // insertion sort is tried while at most one key in this many is out of place
+    static const std::size_t insertionDescentRatio = 32;
+    // gathers in last frame's order prefetch this many particles ahead
+    static const std::size_t prefetchDistance = 16;
+    // key range margin on top of 1/16 of the depth span, keeps it from collapsing
+    static constexpr float minimumMargin = 1e-3f;
+
+    struct Chunk
+    {
+        float minDepth = std::numeric_limits<float>::max();
+        float maxDepth = std::numeric_limits<float>::lowest();
+        std::size_t descents = 0;
+        // of the digit being sorted, then the scatter offset of every bucket
+        uint32_t histogram[256] = {};
+    };
+
+    // keys of slots [begin, end) from their depth along front, straight from
+    // the position arrays so the loop vectorizes
+    static void computeKeys(const ParticleView &particles, float alpha, glm::vec3 eye, glm::vec3 front,
+                            float rangeMin, float scale, std::size_t begin, std::size_t end,
+                            uint16_t *keys, float &minDepth, float &maxDepth)
+    {
+        const float *x = particles.positionX.data();
+        const float *y = particles.positionY.data();
+        const float *z = particles.positionZ.data();
+        const float *px = particles.previousX.data();
+        const float *py = particles.previousY.data();
+        const float *pz = particles.previousZ.data();
+        // dot(position - eye, front) = dot(position, front) - dot(eye, front)
+        const float bias = glm::dot(eye, front);
+        const bool interpolate = alpha < 1.0f;
+        float lo = minDepth, hi = maxDepth;
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            float depth = x[i] * front.x + y[i] * front.y + z[i] * front.z;
+            if (interpolate)
+            {
+                const float previous = px[i] * front.x + py[i] * front.y + pz[i] * front.z;
+                depth = previous + (depth - previous) * alpha;
+            }
+            depth -= bias;
+            lo = std::min(lo, depth);
+            hi = std::max(hi, depth);
+            // farthest gets key 0
+            const float q = std::min(std::max((depth - rangeMin) * scale, 0.0f), static_cast<float>(maxKey));
+            keys[i] = static_cast<uint16_t>(maxKey - static_cast<int32_t>(q));
+        }
+        minDepth = lo;
+        maxDepth = hi;
+    }
+
+    // last frame's order as a permutation of [0, count): slots past the new
+    // alive count drop out, new slots go to the back
+    void carryOrder(std::size_t count)
+    {
+        const std::size_t previous = m_order.size();
+        if (count < previous)
+            m_order.erase(std::remove_if(m_order.begin(), m_order.end(),
+                                         [count](uint32_t index) { return index >= count; }), m_order.end());
+        for (std::size_t i = previous; i < count; ++i)
+            m_order.push_back(static_cast<uint32_t>(i));
+    }
+
+    // insertion sort of keys and order together, gives up (still a valid
+    // permutation) once it has moved more elements than there are particles
+    bool insertionSort(std::size_t count)
+    {
+        std::size_t moves = 0;
+        for (std::size_t j = 1; j < count; ++j)
+        {
+            const uint16_t key = m_keys[j];
+            if (key >= m_keys[j - 1])
+                continue;
+            const uint32_t index = m_order[j];
+            std::size_t i = j;
+            for (; i > 0 && m_keys[i - 1] > key; --i)
+            {
+                m_keys[i] = m_keys[i - 1];
+                m_order[i] = m_order[i - 1];
+            }
+            m_keys[i] = key;
+            m_order[i] = index;
+            moves += j - i;
+            if (moves > count)
+                return false;
+        }
+        return true;
+    }
+
+    // per-chunk histograms of the key byte at shift
+    void buildHistograms(JobSystem *jobSystem, std::size_t count, std::size_t grain, int shift)
+    {
+        parallelForChunks(jobSystem, count, grain, [this, shift](std::size_t chunk, std::size_t begin, std::size_t end) {
+            uint32_t *histogram = m_chunks[chunk].histogram;
+            std::fill(histogram, histogram + 256, 0u);
+            for (std::size_t j = begin; j < end; ++j)
+                ++histogram[(m_keys[j] >> shift) & 0xFF];
+        });
+    }
+
+    // stable scatters by the low then the high byte; the low byte histograms
+    // come from the quantize pass, the high byte ones are counted after the
+    // first scatter has moved keys across chunks
+    void radixSort(JobSystem *jobSystem, std::size_t count, std::size_t grain)
+    {
+        m_keysTemp.resize(count);
+        m_orderTemp.resize(count);
+        for (int shift = 0; shift < 16; shift += 8)
+        {
+            if (shift > 0)
+                buildHistograms(jobSystem, count, grain, shift);
+
+            // bucket by bucket, chunk by chunk: where each chunk writes each bucket
+            uint32_t offset = 0;
+            bool single = false;
+            for (int bucket = 0; bucket < 256; ++bucket)
+            {
+                uint32_t total = 0;
+                for (Chunk &c : m_chunks)
+                {
+                    const uint32_t n = c.histogram[bucket];
+                    c.histogram[bucket] = offset + total;
+                    total += n;
+                }
+                single = single || total == count;
+                offset += total;
+            }
+            // every key has the same byte here, the scatter would copy in order
+            if (single)
+                continue;
+
+            parallelForChunks(jobSystem, count, grain, [this, shift](std::size_t chunk, std::size_t begin, std::size_t end) {
+                uint32_t *offsets = m_chunks[chunk].histogram;
+                for (std::size_t j = begin; j < end; ++j)
+                {
+                    const uint32_t target = offsets[(m_keys[j] >> shift) & 0xFF]++;
+                    m_keysTemp[target] = m_keys[j];
+                    m_orderTemp[target] = m_order[j];
+                }
+            });
+            m_keys.swap(m_keysTemp);
+            m_order.swap(m_orderTemp);
+        }
+    }
+
+    std::vector<uint32_t> m_order;
+    std::vector<uint32_t> m_orderTemp;
+    std::vector<uint16_t> m_keys;
+    std::vector<uint16_t> m_keysTemp;
+    std::vector<uint16_t> m_slotKeys;
+    // depths the keys are quantized between, kept across frames
+    float m_rangeMin = 0.0f;
+    float m_rangeMax = 0.0f;
+    float m_scale = 0.0f;
+    std::vector<Chunk> m_chunks;
+    DepthSortMethod m_method = DepthSortMethod::UNCHANGED;
+};
+
+// instances [begin, end) in the given order, positions interpolated by alpha
+inline void writeSortedParticleInstances(ParticleInstance *instances, const ParticleView &particles, const uint32_t *order,
+                                         float alpha, std::size_t begin, std::size_t end)
+{
+    for (std::size_t j = begin; j < end; ++j)
+    {
+        const std::size_t i = order[j];
+        instances[j].m_position = particles.getPosition(i, alpha);
+        instances[j].m_color = particles.getColor(i);
+        instances[j].m_sprite = particles.sprite[i];
+    }
+}
@@ -0,0 +1,296 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <limits>
+#include <new>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Array-of-structures particle record, 48 bytes per particle
+class Particle {
+public:
+
+    Particle():m_position(0.0f),
+        m_velocity(0.0f),
+        m_color(1.0),
+        m_life(0.0f),
+        m_rotate(0.0f){}
+
+    glm::vec3 m_position;
+    glm::vec3 m_velocity;
+    glm::vec4 m_color;
+    float m_life;
+    float m_rotate;
+};
+
+// std::vector allocator returning memory aligned to a cache line
+template <typename T, std::size_t Alignment = 64>
+class AlignedAllocator
+{
+public:
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() {}
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+    T *allocate(std::size_t n)
+    {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T *p, std::size_t)
+    {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// contiguous slots [begin, end) of a ParticleStore
+struct ParticleRange
+{
+    std::size_t begin = 0;
+    std::size_t end = 0;
+
+    std::size_t size() const { return end - begin; }
+    bool empty() const { return begin == end; }
+};
+
+// axis-aligned box around particle positions, empty (min > max) until merged
+struct ParticleBounds
+{
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+
+    bool empty() const { return min.x > max.x; }
+
+    void merge(const ParticleBounds &other)
+    {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+};
+
+// Structure-of-arrays particle storage. Every field (and every vector
+// component) lives in its own 64-byte aligned array, so a loop that only
+// touches life and position doesn't drag color and rotation through the cache.
+//
+// Slots are kept partitioned: [0, aliveCount()) are alive, the rest are dead.
+// spawn() takes the first dead slot and kill() swaps a particle with the last
+// alive one, so both are O(1) and loops never have to look at dead slots.
+class ParticleStore
+{
+public:
+
+    // floats per 64-byte array line, chunks split on multiples of this never share a line
+    static constexpr std::size_t cacheLineFloats = 64 / sizeof(float);
+    // storage of one slot across all sixteen arrays
+    static constexpr std::size_t bytesPerParticle = 16 * sizeof(float);
+
+    ParticleStore() {}
+    explicit ParticleStore(std::size_t capacity) { resize(capacity); }
+
+    void resize(std::size_t capacity)
+    {
+        m_positionX.assign(capacity, 0.0f);
+        m_positionY.assign(capacity, 0.0f);
+        m_positionZ.assign(capacity, 0.0f);
+        m_previousX.assign(capacity, 0.0f);
+        m_previousY.assign(capacity, 0.0f);
+        m_previousZ.assign(capacity, 0.0f);
+        m_velocityX.assign(capacity, 0.0f);
+        m_velocityY.assign(capacity, 0.0f);
+        m_velocityZ.assign(capacity, 0.0f);
+        m_colorR.assign(capacity, 1.0f);
+        m_colorG.assign(capacity, 1.0f);
+        m_colorB.assign(capacity, 1.0f);
+        m_colorA.assign(capacity, 1.0f);
+        m_life.assign(capacity, 0.0f);
+        m_rotate.assign(capacity, 0.0f);
+        m_sprite.assign(capacity, 0.0f);
+        m_aliveCount = 0;
+    }
+
+    std::size_t size() const { return m_life.size(); }
+    std::size_t aliveCount() const { return m_aliveCount; }
+    bool full() const { return m_aliveCount == size(); }
+
+    // claim the first dead slot, reset to a default particle; the store must not be full
+    std::size_t spawn()
+    {
+        std::size_t i = m_aliveCount++;
+        m_positionX[i] = m_positionY[i] = m_positionZ[i] = 0.0f;
+        m_previousX[i] = m_previousY[i] = m_previousZ[i] = 0.0f;
+        m_velocityX[i] = m_velocityY[i] = m_velocityZ[i] = 0.0f;
+        m_colorR[i] = m_colorG[i] = m_colorB[i] = m_colorA[i] = 1.0f;
+        m_life[i] = 0.0f;
+        m_rotate[i] = 0.0f;
+        m_sprite[i] = 0.0f;
+        return i;
+    }
+
+    // claim up to count dead slots at once (fewer if the store fills up), they
+    // are the contiguous range returned, reset to the same defaults as spawn()
+    ParticleRange spawnRange(std::size_t count)
+    {
+        ParticleRange range;
+        range.begin = m_aliveCount;
+        range.end = m_aliveCount + std::min(count, size() - m_aliveCount);
+        m_aliveCount = range.end;
+        fillRange(m_positionX, range, 0.0f);
+        fillRange(m_positionY, range, 0.0f);
+        fillRange(m_positionZ, range, 0.0f);
+        fillRange(m_previousX, range, 0.0f);
+        fillRange(m_previousY, range, 0.0f);
+        fillRange(m_previousZ, range, 0.0f);
+        fillRange(m_velocityX, range, 0.0f);
+        fillRange(m_velocityY, range, 0.0f);
+        fillRange(m_velocityZ, range, 0.0f);
+        fillRange(m_colorR, range, 1.0f);
+        fillRange(m_colorG, range, 1.0f);
+        fillRange(m_colorB, range, 1.0f);
+        fillRange(m_colorA, range, 1.0f);
+        fillRange(m_life, range, 0.0f);
+        fillRange(m_rotate, range, 0.0f);
+        fillRange(m_sprite, range, 0.0f);
+        return range;
+    }
+
+    static void fillRange(AlignedVector<float> &array, const ParticleRange &range, float value)
+    {
+        std::fill(array.begin() + range.begin, array.begin() + range.end, value);
+    }
+
+    // move particle i to the dead range, the last alive particle takes its slot
+    void kill(std::size_t i)
+    {
+        swapParticles(i, --m_aliveCount);
+    }
+
+    // kill every alive particle whose life ran out, returns how many died
+    std::size_t removeDead()
+    {
+        std::size_t removed = 0;
+        std::size_t i = 0;
+        while (i < m_aliveCount)
+        {
+            if (m_life[i] <= 0.0f)
+            {
+                kill(i); // slot i now holds an unchecked particle
+                ++removed;
+            }
+            else
+            {
+                ++i;
+            }
+        }
+        return removed;
+    }
+
+    // kill every particle from aliveCount on, keeps the first aliveCount alive
+    void truncate(std::size_t aliveCount)
+    {
+        if (aliveCount < m_aliveCount)
+            m_aliveCount = aliveCount;
+    }
+
+    void swapParticles(std::size_t a, std::size_t b)
+    {
+        std::swap(m_positionX[a], m_positionX[b]);
+        std::swap(m_positionY[a], m_positionY[b]);
+        std::swap(m_positionZ[a], m_positionZ[b]);
+        std::swap(m_previousX[a], m_previousX[b]);
+        std::swap(m_previousY[a], m_previousY[b]);
+        std::swap(m_previousZ[a], m_previousZ[b]);
+        std::swap(m_velocityX[a], m_velocityX[b]);
+        std::swap(m_velocityY[a], m_velocityY[b]);
+        std::swap(m_velocityZ[a], m_velocityZ[b]);
+        std::swap(m_colorR[a], m_colorR[b]);
+        std::swap(m_colorG[a], m_colorG[b]);
+        std::swap(m_colorB[a], m_colorB[b]);
+        std::swap(m_colorA[a], m_colorA[b]);
+        std::swap(m_life[a], m_life[b]);
+        std::swap(m_rotate[a], m_rotate[b]);
+        std::swap(m_sprite[a], m_sprite[b]);
+    }
+
+    glm::vec3 getPosition(std::size_t i) const
+    {
+        return glm::vec3(m_positionX[i], m_positionY[i], m_positionZ[i]);
+    }
+
+    void setPosition(std::size_t i, const glm::vec3 &position)
+    {
+        m_positionX[i] = position.x;
+        m_positionY[i] = position.y;
+        m_positionZ[i] = position.z;
+    }
+
+    // remember the positions of [begin, end) as the previous step for interpolation
+    void savePositions(std::size_t begin, std::size_t end)
+    {
+        std::copy(m_positionX.begin() + begin, m_positionX.begin() + end, m_previousX.begin() + begin);
+        std::copy(m_positionY.begin() + begin, m_positionY.begin() + end, m_previousY.begin() + begin);
+        std::copy(m_positionZ.begin() + begin, m_positionZ.begin() + end, m_previousZ.begin() + begin);
+    }
+
+    // position of the previous step blended towards the current one by alpha
+    glm::vec3 getPosition(std::size_t i, float alpha) const
+    {
+        const glm::vec3 previous(m_previousX[i], m_previousY[i], m_previousZ[i]);
+        return previous + (getPosition(i) - previous) * alpha;
+    }
+
+    glm::vec3 getVelocity(std::size_t i) const
+    {
+        return glm::vec3(m_velocityX[i], m_velocityY[i], m_velocityZ[i]);
+    }
+
+    void setVelocity(std::size_t i, const glm::vec3 &velocity)
+    {
+        m_velocityX[i] = velocity.x;
+        m_velocityY[i] = velocity.y;
+        m_velocityZ[i] = velocity.z;
+    }
+
+    glm::vec4 getColor(std::size_t i) const
+    {
+        return glm::vec4(m_colorR[i], m_colorG[i], m_colorB[i], m_colorA[i]);
+    }
+
+    void setColor(std::size_t i, const glm::vec4 &color)
+    {
+        m_colorR[i] = color.r;
+        m_colorG[i] = color.g;
+        m_colorB[i] = color.b;
+        m_colorA[i] = color.a;
+    }
+
+    AlignedVector<float> m_positionX, m_positionY, m_positionZ;
+    // positions before the last Update, only read when rendering interpolates
+    AlignedVector<float> m_previousX, m_previousY, m_previousZ;
+    AlignedVector<float> m_velocityX, m_velocityY, m_velocityZ;
+    AlignedVector<float> m_colorR, m_colorG, m_colorB, m_colorA;
+    AlignedVector<float> m_life;
+    AlignedVector<float> m_rotate;
+    // index of the atlas sprite the particle is drawn with, kept as a float
+    // like every other array; exact for any realistic sprite count
+    AlignedVector<float> m_sprite;
+
+private:
+
+    std::size_t m_aliveCount = 0;
+};
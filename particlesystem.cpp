@@ -1 +1,192 @@
 #include "particlesystem.h"
+
+#include <cstring>
+
+ParticleSystem::ParticleSystem(Shader shader, uint32_t amount) :
+    m_simulation(amount), m_amount(amount), m_shader(shader){
+    m_drawSettings.radius = billboardRadius;
+}
+
+ParticleSystem::~ParticleSystem() {
+    glDeleteVertexArrays(1, &m_VAO);
+    glDeleteBuffers(1, &m_VBO);
+}
+
+void ParticleSystem::Initialize() {
+    // set up mesh and attribute properties
+    float particle_quad[] = {
+        0.0f, 1.0f, 0.0f, 1.0f,
+        1.0f, 0.0f, 1.0f, 0.0f,
+        0.0f, 0.0f, 0.0f, 0.0f,
+
+        0.0f, 1.0f, 0.0f, 1.0f,
+        1.0f, 1.0f, 1.0f, 1.0f,
+        1.0f, 0.0f, 1.0f, 0.0f
+    };
+    glGenVertexArrays(1, &m_VAO);
+    glGenBuffers(1, &m_VBO);
+    glBindVertexArray(m_VAO);
+    // fill mesh buffet
+    glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(particle_quad), particle_quad, GL_STATIC_DRAW);
+    // set mesh attributes
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
+    // per-instance position, color and sprite, advanced once per drawn instance; the
+    // pointers are moved to the current stream region in renderInstanced
+    m_instanceStream.Initialize(m_amount * sizeof(ParticleInstance));
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1);
+    glEnableVertexAttribArray(3);
+    glVertexAttribDivisor(3, 1);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+
+void ParticleSystem::Render(){
+    // additive blending gives a 'glow' effect, alpha blending wants setDepthSort
+    applyBlendMode();
+    m_shader.useShaderProgram();
+    m_drawCalls = 0;
+    if (m_instanced)
+        renderInstanced();
+    else
+        renderPerParticle();
+    // don't forget to reset to default blending mode
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+void ParticleSystem::renderInstanced(){
+    // Upload already wrote the alive particles into the current stream region
+    if (m_instanceCount == 0)
+        return;
+
+    const std::size_t offset = m_instanceStream.getOffset();
+    glBindVertexArray(m_VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, m_instanceStream.getBuffer());
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(ParticleInstance), (void*)(offset + offsetof(ParticleInstance, m_position)));
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(ParticleInstance), (void*)(offset + offsetof(ParticleInstance, m_color)));
+    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(ParticleInstance), (void*)(offset + offsetof(ParticleInstance, m_sprite)));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 6, static_cast<GLsizei>(m_instanceCount));
+    glBindVertexArray(0);
+    // the region can be written again once this draw has finished
+    m_instanceStream.fence();
+    ++m_drawCalls;
+}
+
+void ParticleSystem::renderPerParticle(){
+    glBindVertexArray(m_VAO);
+    // with the instance arrays disabled the shader reads the current generic attribute values
+    glDisableVertexAttribArray(1);
+    glDisableVertexAttribArray(2);
+    glDisableVertexAttribArray(3);
+    auto draw = [this](const ParticleInstance &instance) {
+        glVertexAttrib3fv(1, &instance.m_position.x);
+        glVertexAttrib4fv(2, &instance.m_color.r);
+        glVertexAttrib1f(3, instance.m_sprite);
+        //m_shader.setUniform("rotation", particle.m_rotate);
+        //this->texture.Bind();
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+        ++m_drawCalls;
+    };
+    if (m_simulationThread)
+    {
+        // the snapshot is already interpolated and in draw order
+        const SimulationSnapshot &snapshot = m_simulationThread->current();
+        for (std::size_t i = 0; i < snapshot.count; ++i)
+            draw(snapshot.instances[i]);
+    }
+    else
+    {
+        const ParticleView particles = m_simulation.getAliveParticles();
+        for (std::size_t j = 0; j < m_drawList.count; ++j)
+        {
+            const std::size_t i = m_drawList.order ? m_drawList.order[j] : j;
+            draw(ParticleInstance{ particles.getPosition(i, m_drawSettings.alpha), particles.getColor(i), particles.sprite[i] });
+        }
+    }
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+    glEnableVertexAttribArray(3);
+    glBindVertexArray(0);
+}
+
+void ParticleSystem::Upload(){
+    m_instanceCount = 0;
+    if (m_simulationThread)
+    {
+        uploadSnapshot();
+        return;
+    }
+
+    m_drawList = m_drawListBuilder.build(m_simulation, m_drawSettings);
+    m_drawnCount = m_drawList.count;
+    m_culledCount = m_drawList.culled;
+    // a culled emitter doesn't touch the stream at all
+    if (!m_instanced || m_drawList.count == 0)
+        return;
+
+    ParticleInstance *instances = static_cast<ParticleInstance*>(m_instanceStream.map());
+    if (instances)
+    {
+        DrawListBuilder::writeInstances(instances, m_simulation.getAliveParticles(), m_drawList, m_drawSettings.alpha,
+                                        m_simulation.getJobSystem(), m_simulation.getGrainSize());
+        m_instanceCount = static_cast<unsigned int>(m_drawList.count);
+    }
+    m_instanceStream.unmap();
+}
+
+void ParticleSystem::uploadSnapshot(){
+    // the simulation thread already culled, sorted, interpolated and packed the instances
+    m_simulationThread->publish(m_drawSettings);
+    const SimulationSnapshot &snapshot = m_simulationThread->acquire();
+    m_drawnCount = snapshot.count;
+    m_culledCount = snapshot.culled;
+    if (!m_instanced || snapshot.count == 0)
+        return;
+
+    void *instances = m_instanceStream.map();
+    if (instances)
+    {
+        std::memcpy(instances, snapshot.instances.data(), snapshot.count * sizeof(ParticleInstance));
+        m_instanceCount = static_cast<unsigned int>(snapshot.count);
+    }
+    m_instanceStream.unmap();
+}
+
+void ParticleSystem::Simulate(float dt, unsigned int newParticles, glm::vec3 offset){
+    if (m_simulationThread)
+        m_simulationThread->step(dt, newParticles, offset);
+    else
+        m_simulation.Update(dt, newParticles, offset);
+}
+
+void ParticleSystem::AddParticles(short int type, glm::vec3 position, glm::vec3 velocity, float rotation, unsigned int newParticles, glm::vec3 offset) {
+    if (m_simulationThread)
+        m_simulationThread->spawn(type, position, velocity, rotation, newParticles, offset);
+    else
+        m_simulation.AddParticles(type, position, velocity, rotation, newParticles, offset);
+}
+
+void ParticleSystem::setInterpolation(float alpha){
+    if (!m_interpolated)
+    {
+        m_interpolated = true;
+        if (m_simulationThread)
+            m_simulationThread->setInterpolated(true);
+        else
+            m_simulation.setInterpolated(true);
+    }
+    m_drawSettings.alpha = alpha;
+}
+
+void ParticleSystem::setAsyncSimulation(bool async){
+    if (async && !m_simulationThread)
+        m_simulationThread = std::make_unique<SimulationThread>(m_simulation);
+    else if (!async)
+        m_simulationThread.reset(); // runs the queued work first
+}
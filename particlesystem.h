@@ -1,188 +1,100 @@
 #pragma once
 
 #include <vector>
+#include <cstddef>
+#include <memory>
 #include <glm/glm.hpp>
 #include <GL/glew.h>
 
 #include "shaders.hpp"
 #include "glerror.hpp"
+#include "particlesimulation.h"
+#include "particledraw.h"
+#include "simulationthread.h"
+#include "particlebackend.h"
+#include "streambuffer.h"
 
-class Particle {
-public:
-
-    Particle():m_position(0.0f),
-        m_velocity(0.0f),
-        m_color(1.0),
-        m_life(0.0f),
-        m_rotate(0.0f){}
-
-    glm::vec3 m_position;
-    glm::vec3 m_velocity;
-    glm::vec4 m_color;
-    float m_life;
-    float m_rotate;
-};
-
-class ParticleSystem
+class ParticleSystem : public ParticleBackend
 {
 public:
-    ParticleSystem() {}
+    // half diagonal of the quad shaderVertex draws, 4 units wide in view space
+    static constexpr float billboardRadius = 2.83f;
+
+    ParticleSystem() { m_drawSettings.radius = billboardRadius; }
     ParticleSystem(Shader shader, uint32_t amount);
-    ~ParticleSystem() {
-        glDeleteVertexArrays(1, &m_VAO);
-        glDeleteBuffers(1, &m_VBO);
+    ~ParticleSystem();
+
+    void Initialize() override;
+    void Render() override;
+    void Simulate(float dt, unsigned int newParticles, glm::vec3 offset) override;
+    // write the alive particles straight into the mapped instance stream for the next Render
+    void Upload() override;
+    void setInterpolation(float alpha) override;
+    // simulate on a SimulationThread: Simulate and AddParticles only queue
+    // work, Upload copies the newest snapshot, one frame behind at most
+    void setAsyncSimulation(bool async) override;
+    bool isAsyncSimulation() const { return m_simulationThread != nullptr; }
+    // Upload writes the instances back to front, see DepthSorter
+    void setDepthSort(bool sort) override { m_drawSettings.depthSort = sort; }
+    bool isDepthSort() const { return m_drawSettings.depthSort; }
+    void setViewer(glm::vec3 position, glm::vec3 front) override {
+        m_drawSettings.eye = position;
+        m_drawSettings.front = front;
     }
-
-    void Initialize();
-    void Render();
-    void Update(float dt, unsigned int newParticles, glm::vec3 offset);
-    void AddParticles(short int type, glm::vec3 position, glm::vec3 velocity, float rotation, unsigned int newParticles, glm::vec3 offset);
+    // Upload skips the particles outside the frustum, see DrawListBuilder
+    void setCulling(ParticleCulling culling) override { m_drawSettings.culling = culling; }
+    ParticleCulling getCulling() const { return m_drawSettings.culling; }
+    void setFrustum(const glm::mat4 &viewProjection) override { m_drawSettings.frustum = Frustum::fromMatrix(viewProjection); }
+    std::size_t getDrawnParticles() const override { return m_drawnCount; }
+    std::size_t getCulledParticles() const override { return m_culledCount; }
+    std::size_t getAllocatedParticles() const override { return m_amount; }
+    std::size_t getLiveParticles() const override { return m_drawnCount + m_culledCount; }
+    // how the last synchronous Upload ordered the particles
+    DepthSortMethod getLastSortMethod() const { return m_drawListBuilder.getLastSortMethod(); }
+    void AddParticles(short int type, glm::vec3 position, glm::vec3 velocity, float rotation, unsigned int newParticles, glm::vec3 offset) override;
+
+    ParticleBackendType getType() const override { return ParticleBackendType::CPU; }
+    Shader &getShader() override { return m_shader; }
+
+    // draw all live particles with one glDrawArraysInstanced call instead of one draw per particle
+    void setInstanced(bool instanced) { m_instanced = instanced; }
+    bool isInstanced() const { return m_instanced; }
+
+    // number of draw calls issued by the last Render()
+    unsigned int getDrawCalls() const override { return m_drawCalls; }
+
+    // run Simulate and Upload on the given pool, see ParticleSimulation::setJobSystem
+    void setJobSystem(JobSystem *jobSystem) { m_simulation.setJobSystem(jobSystem); }
+    void setGrainSize(std::size_t grainSize) { m_simulation.setGrainSize(grainSize); }
+    std::size_t getGrainSize() const { return m_simulation.getGrainSize(); }
+
+    // not while the simulation runs asynchronously
+    ParticleSimulation &getSimulation() { return m_simulation; }
+
+    // bytes written to the instance stream by the last Upload()
+    std::size_t getUploadedBytes() const override { return m_instanceCount * sizeof(ParticleInstance); }
 private:
 
-    std::vector<Particle> m_particles;
+    ParticleSimulation m_simulation;
+    StreamBuffer m_instanceStream;
     unsigned int m_amount;
     unsigned int m_VBO, m_VAO;
-    unsigned int lastUsedParticle = 0;
+    unsigned int m_instanceCount = 0;
+    unsigned int m_drawCalls = 0;
+    bool m_instanced = true;
+    bool m_interpolated = false;
+    DrawSettings m_drawSettings;
+    DrawListBuilder m_drawListBuilder;
+    // what the last synchronous Upload drew
+    DrawList m_drawList;
+    std::size_t m_drawnCount = 0;
+    std::size_t m_culledCount = 0;
     Shader m_shader;
+    // declared after m_simulation, so it stops before the simulation goes away
+    std::unique_ptr<SimulationThread> m_simulationThread;
 
-    unsigned int firstUnusedParticle();
-     void respawnParticle(Particle &particle, short type, glm::vec3 position, glm::vec3 velocity, float rotation, glm::vec3 offset = glm::vec3(0.0f, 0.0f,0.0f));
+    void renderInstanced();
+    void renderPerParticle();
+    void uploadSnapshot();
 };
 
-
-ParticleSystem::ParticleSystem(Shader shader, uint32_t amount) :
-    m_shader(shader), m_amount(amount){
-}
-
-void ParticleSystem::Initialize() {
-    // set up mesh and attribute properties
-    float particle_quad[] = {
-        0.0f, 1.0f, 0.0f, 1.0f,
-        1.0f, 0.0f, 1.0f, 0.0f,
-        0.0f, 0.0f, 0.0f, 0.0f,
-
-        0.0f, 1.0f, 0.0f, 1.0f,
-        1.0f, 1.0f, 1.0f, 1.0f,
-        1.0f, 0.0f, 1.0f, 0.0f
-    };
-    glGenVertexArrays(1, &m_VAO);
-    glGenBuffers(1, &m_VBO);
-    glBindVertexArray(m_VAO);
-    // fill mesh buffet
-    glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(particle_quad), particle_quad, GL_STATIC_DRAW);
-    // set mesh attributes
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
-    glBindVertexArray(0);
-    // create default particle instances
-    for (unsigned int i = 0; i < m_amount; ++i)
-        m_particles.push_back(Particle());
-
-}
-
-
-void ParticleSystem::Render(){
-    // use additive blending to give it a 'glow' effect
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-    m_shader.useShaderProgram();
-    for (Particle particle : m_particles)
-    {
-        if (particle.m_life > 0.0f)
-        {
-            //m_shader.setUniformVec2("offset", particle.m_position);
-            m_shader.setUniformVec3("offset", particle.m_position);
-            m_shader.setUniformVec4("color", particle.m_color);
-            //m_shader.setUniform("rotation", particle.m_rotate);
-            //this->texture.Bind();
-            glBindVertexArray(m_VAO);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
-            glBindVertexArray(0);
-        }
-    }
-    // don't forget to reset to default blending mode
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-}
-
-void ParticleSystem::Update(float dt, unsigned int newParticles, glm::vec3 offset = glm::vec3(1.0f, 2.0f,3.0f)){
-
-/*    for (unsigned int i = 0; i < newParticles; i++)
-    {
-        int unusedParticle = firstUnusedParticle();
-        respawnParticle(m_particles[unusedParticle], 0, glm::vec3(1,1,1), glm::vec3(1,1,1), 60, offset);
-    }*/
-
-
-    for (int i = 0; i < newParticles; ++i) {
-        this->m_particles[i].m_life  -= dt;
-
-        // if the lifetime is below 0 respawn the particle
-        if ( this->m_particles[i].m_life <= 0.0f )
-        {
-            this->m_particles[i].m_position = glm::vec3( 0,rand() %50,0);
-            this->m_particles[i].m_life = rand() % 10;
-        }
-
-        // move the particle down depending on the delta time
-        this->m_particles[i].m_position -=  glm::vec3( 0.0f , dt*2.0f , 0.0f );
-
-     //    lastUsedParticle = i;
-
-
-    }
-
-    // update all particles
-    for (unsigned int i = 0; i < this->m_amount; ++i)
-    {
-        Particle &p = this->m_particles[i];
-        p.m_life -= dt; // reduce life
-        if (p.m_life > 0.0f)
-        {	// particle is alive, thus update
-            p.m_position -= p.m_velocity * dt * 2.f;
-            p.m_color.a -= dt * 1.f;
-        }
-    }
-}
-
-void ParticleSystem::AddParticles(short int type, glm::vec3 position, glm::vec3 velocity, float rotation, unsigned int newParticles, glm::vec3 offset) {
-    // add new particles
-    for (unsigned int i = 0; i < newParticles; ++i)
-    {
-        int unusedParticle = firstUnusedParticle();
-        respawnParticle(m_particles[unusedParticle], type, position, velocity, rotation, offset);
-    }
-}
-
-unsigned int ParticleSystem::firstUnusedParticle()
-{
-    // first search from last used particle, this will usually return almost instantly
-    for (unsigned int i = lastUsedParticle; i < m_amount; ++i){
-        if (this->m_particles[i].m_life <= 0.0f){
-            lastUsedParticle = i;
-            return i;
-        }
-    }
-    // otherwise, do a linear search
-    for (unsigned int i = 0; i < lastUsedParticle; ++i){
-        if (this->m_particles[i].m_life <= 0.0f){
-            lastUsedParticle = i;
-            return i;
-        }
-    }
-    // all particles are taken, override the first one (note that if it repeatedly hits this case, more particles should be reserved)
-    lastUsedParticle = 0;
-    return 0;
-}
-
-void ParticleSystem::respawnParticle(Particle& particle, short int type, glm::vec3 position, glm::vec3 velocity, float rotation, glm::vec3 offset){
-    float random = ((rand() % 100) - 50) / 10.0f;
-    float random2 = ((rand() % 20) - 20) / 2.0f;
-    float random3 = ((rand() % 10) - 10) / 1.0f;
-    float rColor = 0.5f + ((rand() % 100) / 100.0f);
-   // particle.m_position = glm::vec3(random, 1, 1) * random3;
-   //particle.m_color = glm::vec4(rColor, rColor, rColor, 1.0f);
-    particle.m_life = 1.f;
-   // particle.m_rotate = rotation;*/
-    particle.m_velocity = glm::vec3(0.01f,0.01f, 0.01f) ;
-}
-
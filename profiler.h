@@ -0,0 +1,397 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+// The last `window` samples of a timing in milliseconds, plus a log-scale
+// histogram of them that is kept up to date as samples come and go.
+class RollingHistogram
+{
+public:
+
+    // four seconds at 60 fps
+    static const std::size_t window = 240;
+    static const int bucketCount = 32;
+    // two buckets per octave from 10 us, the first and last are open-ended
+    static constexpr double minimum = 0.01;
+
+    void add(double ms)
+    {
+        if (m_count == window)
+            --m_buckets[bucketOf(m_samples[m_next])];
+        else
+            ++m_count;
+        m_samples[m_next] = ms;
+        ++m_buckets[bucketOf(ms)];
+        m_next = (m_next + 1) % window;
+    }
+
+    std::size_t size() const { return m_count; }
+    bool empty() const { return m_count == 0; }
+
+    // i-th oldest sample of the window
+    double sample(std::size_t i) const { return m_samples[(m_next + window - m_count + i) % window]; }
+    double last() const { return m_count ? sample(m_count - 1) : 0.0; }
+
+    double average() const
+    {
+        double sum = 0.0;
+        for (std::size_t i = 0; i < m_count; ++i)
+            sum += sample(i);
+        return m_count ? sum / m_count : 0.0;
+    }
+
+    double maximum() const
+    {
+        double result = 0.0;
+        for (std::size_t i = 0; i < m_count; ++i)
+            result = std::max(result, sample(i));
+        return result;
+    }
+
+    // nearest rank over the window
+    double percentile(double p) const
+    {
+        if (m_count == 0)
+            return 0.0;
+        std::vector<double> sorted(m_count);
+        for (std::size_t i = 0; i < m_count; ++i)
+            sorted[i] = sample(i);
+        std::size_t rank = static_cast<std::size_t>(p * m_count + 0.5);
+        rank = std::min(rank > 0 ? rank - 1 : 0, m_count - 1);
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+        return sorted[rank];
+    }
+
+    uint32_t getBucket(int bucket) const { return m_buckets[bucket]; }
+    // lowest time that lands in the bucket
+    static double bucketBegin(int bucket) { return bucket == 0 ? 0.0 : minimum * std::exp2(bucket / 2.0); }
+
+    static int bucketOf(double ms)
+    {
+        if (!(ms >= minimum))
+            return 0;
+        return std::min(static_cast<int>(std::log2(ms / minimum) * 2.0), bucketCount - 1);
+    }
+
+private:
+
+    double m_samples[window] = {};
+    std::size_t m_next = 0;
+    std::size_t m_count = 0;
+    uint32_t m_buckets[bucketCount] = {};
+};
+
+// Frame profiler of the render thread. Code is split into named zones
+// (PROFILE_ZONE); every zone gets the CPU time spent in it per frame from
+// steady_clock and, with GPU timing on, the GPU time of its commands from
+// GL_TIME_ELAPSED queries. endFrame() closes a frame and feeds the
+// rolling histograms that on-screen counters and dump() read.
+//
+// GPU results arrive a few frames late. Each zone cycles through a ring of
+// queryRing queries and only reads the ones whose result is available, so
+// the profiler never waits on the GPU; if all of them are still pending a
+// sample is skipped instead. Only one GL_TIME_ELAPSED query can be active at
+// a time, so zones nested inside a GPU timed zone get CPU time only.
+class Profiler
+{
+public:
+
+    // frames a GPU result may lag behind before its zone skips a sample
+    static const std::size_t queryRing = 4;
+
+    struct Zone
+    {
+        std::string name;
+        RollingHistogram cpu;
+        RollingHistogram gpu;
+        // GPU samples dropped because every query of the ring was pending
+        uint64_t gpuSkipped = 0;
+    };
+
+    static Profiler &instance()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    Profiler(const Profiler &) = delete;
+    Profiler &operator=(const Profiler &) = delete;
+
+    // needs a current GL 3.3 context when turned on or off
+    void setGpuTiming(bool enabled)
+    {
+        if (enabled == m_gpuTiming)
+            return;
+        m_gpuTiming = enabled;
+        for (ZoneState &state : m_states)
+        {
+            if (enabled)
+                createQueries(state);
+            else
+                deleteQueries(state);
+        }
+    }
+    bool isGpuTiming() const { return m_gpuTiming; }
+
+    // index of the zone called name, added on first use
+    unsigned int registerZone(const char *name)
+    {
+        for (std::size_t i = 0; i < m_zones.size(); ++i)
+        {
+            if (m_zones[i].name == name)
+                return static_cast<unsigned int>(i);
+        }
+        m_zones.push_back(Zone());
+        m_zones.back().name = name;
+        m_states.push_back(ZoneState());
+        if (m_gpuTiming)
+            createQueries(m_states.back());
+        return static_cast<unsigned int>(m_zones.size() - 1);
+    }
+
+    void beginZone(unsigned int zone)
+    {
+        ZoneState &state = m_states[zone];
+        state.start = std::chrono::steady_clock::now();
+        if (m_gpuTiming && !m_gpuZoneActive)
+        {
+            if (state.issued - state.collected < queryRing)
+            {
+                glBeginQuery(GL_TIME_ELAPSED, state.queries[state.issued % queryRing]);
+                state.gpuActive = true;
+                m_gpuZoneActive = true;
+            }
+            else
+            {
+                ++m_zones[zone].gpuSkipped;
+            }
+        }
+    }
+
+    void endZone(unsigned int zone)
+    {
+        ZoneState &state = m_states[zone];
+        if (state.gpuActive)
+        {
+            glEndQuery(GL_TIME_ELAPSED);
+            ++state.issued;
+            state.gpuActive = false;
+            m_gpuZoneActive = false;
+        }
+        state.frameTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - state.start).count();
+        state.entered = true;
+    }
+
+    // every zone entered since the last call adds its CPU time, summed over
+    // the frame; finished GPU queries add theirs
+    void endFrame()
+    {
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (m_frames > 0)
+            m_frameTimes.add(std::chrono::duration<double, std::milli>(now - m_frameStart).count());
+        m_frameStart = now;
+        ++m_frames;
+
+        for (std::size_t i = 0; i < m_zones.size(); ++i)
+        {
+            ZoneState &state = m_states[i];
+            if (state.entered)
+                m_zones[i].cpu.add(state.frameTime);
+            state.frameTime = 0.0;
+            state.entered = false;
+            collectQueries(state, m_zones[i]);
+        }
+    }
+
+    std::size_t getZoneCount() const { return m_zones.size(); }
+    const Zone &getZone(unsigned int zone) const { return m_zones[zone]; }
+    // endFrame to endFrame
+    const RollingHistogram &getFrameTimes() const { return m_frameTimes; }
+    uint64_t getFrameCount() const { return m_frames; }
+
+    // "update 0.31/0.02 upload ...", average CPU/GPU ms of every zone
+    std::string getSummary() const
+    {
+        std::string summary;
+        char buffer[96];
+        for (const Zone &zone : m_zones)
+        {
+            if (m_gpuTiming)
+                snprintf(buffer, sizeof(buffer), "%s%s %.2f/%.2f", summary.empty() ? "" : " ",
+                         zone.name.c_str(), zone.cpu.average(), zone.gpu.average());
+            else
+                snprintf(buffer, sizeof(buffer), "%s%s %.2f", summary.empty() ? "" : " ", zone.name.c_str(), zone.cpu.average());
+            summary += buffer;
+        }
+        return summary;
+    }
+
+    // statistics and histogram of every zone over the current window,
+    // .json writes JSON, anything else CSV
+    bool dump(const std::string &path) const
+    {
+        FILE *file = fopen(path.c_str(), "w");
+        if (!file)
+        {
+            std::cerr << "[WARN] Failed open " << path << std::endl;
+            return false;
+        }
+        if (path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0)
+            writeJson(file);
+        else
+            writeCsv(file);
+        fclose(file);
+        return true;
+    }
+
+private:
+
+    struct ZoneState
+    {
+        std::chrono::steady_clock::time_point start;
+        double frameTime = 0.0;
+        bool entered = false;
+        bool gpuActive = false;
+        GLuint queries[queryRing] = {};
+        // queries begun and read back so far
+        uint64_t issued = 0;
+        uint64_t collected = 0;
+    };
+
+    Profiler() {}
+
+    static void createQueries(ZoneState &state)
+    {
+        glGenQueries(static_cast<GLsizei>(queryRing), state.queries);
+        state.issued = 0;
+        state.collected = 0;
+    }
+
+    static void deleteQueries(ZoneState &state)
+    {
+        glDeleteQueries(static_cast<GLsizei>(queryRing), state.queries);
+        state.issued = 0;
+        state.collected = 0;
+    }
+
+    // oldest first, stops at the first one still in flight
+    static void collectQueries(ZoneState &state, Zone &zone)
+    {
+        while (state.collected < state.issued)
+        {
+            const GLuint query = state.queries[state.collected % queryRing];
+            GLint available = 0;
+            glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+            zone.gpu.add(elapsed / 1e6);
+            ++state.collected;
+        }
+    }
+
+    struct Row
+    {
+        const char *zone;
+        const char *clock;
+        const RollingHistogram *histogram;
+    };
+
+    std::vector<Row> rows() const
+    {
+        std::vector<Row> result;
+        result.push_back({ "frame", "cpu", &m_frameTimes });
+        for (const Zone &zone : m_zones)
+        {
+            result.push_back({ zone.name.c_str(), "cpu", &zone.cpu });
+            if (m_gpuTiming)
+                result.push_back({ zone.name.c_str(), "gpu", &zone.gpu });
+        }
+        return result;
+    }
+
+    // one row per zone and clock, the bucket counts follow the statistics
+    void writeCsv(FILE *file) const
+    {
+        fprintf(file, "zone,clock,samples,last_ms,avg_ms,p50_ms,p95_ms,p99_ms,max_ms");
+        for (int b = 0; b < RollingHistogram::bucketCount; ++b)
+            fprintf(file, ",ge_%.3f_ms", RollingHistogram::bucketBegin(b));
+        fprintf(file, "\n");
+        for (const Row &row : rows())
+        {
+            const RollingHistogram &h = *row.histogram;
+            fprintf(file, "%s,%s,%zu,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f", row.zone, row.clock, h.size(), h.last(), h.average(),
+                    h.percentile(0.50), h.percentile(0.95), h.percentile(0.99), h.maximum());
+            for (int b = 0; b < RollingHistogram::bucketCount; ++b)
+                fprintf(file, ",%u", h.getBucket(b));
+            fprintf(file, "\n");
+        }
+    }
+
+    void writeJson(FILE *file) const
+    {
+        fprintf(file, "{\n  \"frames\": %llu,\n  \"gpu_timing\": %s,\n  \"bucket_begin_ms\": [",
+                static_cast<unsigned long long>(m_frames), m_gpuTiming ? "true" : "false");
+        for (int b = 0; b < RollingHistogram::bucketCount; ++b)
+            fprintf(file, "%s%.3f", b ? ", " : "", RollingHistogram::bucketBegin(b));
+        fprintf(file, "],\n  \"zones\": [\n");
+        const std::vector<Row> all = rows();
+        for (std::size_t i = 0; i < all.size(); ++i)
+        {
+            const RollingHistogram &h = *all[i].histogram;
+            fprintf(file, "    { \"zone\": \"%s\", \"clock\": \"%s\", \"samples\": %zu, \"last_ms\": %.6f, \"avg_ms\": %.6f, "
+                          "\"p50_ms\": %.6f, \"p95_ms\": %.6f, \"p99_ms\": %.6f, \"max_ms\": %.6f, \"histogram\": [",
+                    all[i].zone, all[i].clock, h.size(), h.last(), h.average(),
+                    h.percentile(0.50), h.percentile(0.95), h.percentile(0.99), h.maximum());
+            for (int b = 0; b < RollingHistogram::bucketCount; ++b)
+                fprintf(file, "%s%u", b ? ", " : "", h.getBucket(b));
+            fprintf(file, "] }%s\n", i + 1 < all.size() ? "," : "");
+        }
+        fprintf(file, "  ]\n}\n");
+    }
+
+    std::vector<Zone> m_zones;
+    std::vector<ZoneState> m_states;
+    RollingHistogram m_frameTimes;
+    std::chrono::steady_clock::time_point m_frameStart;
+    uint64_t m_frames = 0;
+    bool m_gpuTiming = false;
+    // a GL_TIME_ELAPSED query is running, nested zones don't start another
+    bool m_gpuZoneActive = false;
+};
+
+// times the enclosing scope as one zone
+class ProfileScope
+{
+public:
+
+    explicit ProfileScope(unsigned int zone) : m_zone(zone) { Profiler::instance().beginZone(zone); }
+    ~ProfileScope() { Profiler::instance().endZone(m_zone); }
+
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+
+    unsigned int m_zone;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+// profile the rest of the enclosing scope as zone name; the zone is looked
+// up once per call site
+#define PROFILE_ZONE(name) \
+    static const unsigned int PROFILE_CONCAT(profileZone, __LINE__) = Profiler::instance().registerZone(name); \
+    ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(PROFILE_CONCAT(profileZone, __LINE__))
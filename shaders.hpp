@@ -1,9 +1,22 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 
+#include "binaryfile.h"
+
 /*const char *shaderVertex =
     "#version 330 core\n"
     "#extension GL_ARB_separate_shader_objects : enable\n"
@@ -42,22 +55,30 @@ const char *shaderVertex =
     "    gl_Position = projection * model * view * transform * vec4((vertex.xy * 1) + offset, 0.0, 5.0);\n"
     "}\n";
 */
-const char *shaderVertex =
+// size of the spriteRects table, atlas sprites a particle can pick from
+inline constexpr unsigned int maxParticleSprites = 64;
+
+inline const char *shaderVertex =
     "#version 330 core\n"
     "layout (location = 0) in vec4 vertex;\n"
+    "// per-instance attributes, advanced once per particle (divisor 1)\n"
+    "layout (location = 1) in vec3 offset;\n"
+    "layout (location = 2) in vec4 color;\n"
+    "layout (location = 3) in float sprite;\n"
     "//#extension GL_ARB_separate_shader_objects : enable\n"
     "out vec2 TexCoords;\n"
     "out vec4 ParticleColor;\n"
     "uniform mat4 model;\n"
     "uniform mat4 view;\n"
     "uniform mat4 projection;\n"
-    "uniform vec3 offset;\n"
-    "uniform vec4 color;\n"
+    "// atlas rectangle of every sprite, xy the corner and zw the size in texture coordinates\n"
+    "uniform vec4 spriteRects[64];\n"
     "//uniform mat4 transform;\n"
     "void main()\n"
     "{\n"
     "    float scale = 10.0;\n"
-    "    TexCoords = vertex.zw;\n"
+    "    vec4 rect = spriteRects[clamp(int(sprite), 0, 63)];\n"
+    "    TexCoords = rect.xy + vertex.zw * rect.zw;\n"
     "    ParticleColor = color;\n"
     "    //gl_Position = projection * model * view * transform * vec4((vertex.xy * 1) + offset, 0.0, 5.0);\n"
     "    vec4 pos_view = view * vec4(offset.xyz, 1.0);\n"
@@ -78,7 +99,7 @@ const char* shaderFragment =
     "}\n;";
 */
 
-const char *shaderFragment =
+inline const char *shaderFragment =
 "#version 330 core\n"
 "in vec2 TexCoords;\n"
 "in vec4 ParticleColor;\n"
@@ -92,15 +113,213 @@ const char *shaderFragment =
 "}\n";
 
 
-const char *shaderGeometry =
+inline const char *shaderGeometry =
     "\n";
 
+// Transform feedback update pass: one point per particle, the outputs are
+// captured interleaved into the other buffer of the ping-pong pair.
+inline const char *shaderFeedbackUpdate =
+    "#version 330 core\n"
+    "layout (location = 0) in vec3 position;\n"
+    "layout (location = 1) in vec3 velocity;\n"
+    "layout (location = 2) in vec4 color;\n"
+    "layout (location = 3) in float life;\n"
+    "out vec3 outPosition;\n"
+    "out vec3 outVelocity;\n"
+    "out vec4 outColor;\n"
+    "out float outLife;\n"
+    "uniform float dt;\n"
+    "uniform uint rainCount;\n"
+    "uniform uint frame;\n"
+    "uint hash(uint x)\n"
+    "{\n"
+    "    x ^= x >> 16; x *= 0x7feb352dU;\n"
+    "    x ^= x >> 15; x *= 0x846ca68bU;\n"
+    "    x ^= x >> 16;\n"
+    "    return x;\n"
+    "}\n"
+    "void main()\n"
+    "{\n"
+    "    vec3 p = position;\n"
+    "    float l = life;\n"
+    "    // same rain as the first newParticles slots in ParticleSystem::Update\n"
+    "    if (uint(gl_VertexID) < rainCount)\n"
+    "    {\n"
+    "        l -= dt;\n"
+    "        if (l <= 0.0)\n"
+    "        {\n"
+    "            uint h = hash(uint(gl_VertexID) ^ hash(frame));\n"
+    "            p = vec3(0.0, float(h % 50u), 0.0);\n"
+    "            l = float(hash(h) % 10u);\n"
+    "        }\n"
+    "        p.y -= dt * 2.0;\n"
+    "    }\n"
+    "    outVelocity = velocity;\n"
+    "    outLife = l - dt;\n"
+    "    bool alive = outLife > 0.0;\n"
+    "    outPosition = alive ? p - velocity * dt * 2.0 : p;\n"
+    "    outColor = alive ? vec4(color.rgb, color.a - dt) : color;\n"
+    "}\n";
+
+// Compute update pass, the same integration as shaderFeedbackUpdate run over
+// the particle SSBO in place.
+inline const char *shaderComputeUpdate =
+    "#version 430 core\n"
+    "layout (local_size_x = 256) in;\n"
+    "struct Particle { vec4 positionLife; vec4 velocity; vec4 color; };\n"
+    "layout (std430, binding = 0) buffer Particles { Particle particles[]; };\n"
+    "uniform float dt;\n"
+    "uniform uint amount;\n"
+    "uniform uint rainCount;\n"
+    "uniform uint frame;\n"
+    "uint hash(uint x)\n"
+    "{\n"
+    "    x ^= x >> 16; x *= 0x7feb352dU;\n"
+    "    x ^= x >> 15; x *= 0x846ca68bU;\n"
+    "    x ^= x >> 16;\n"
+    "    return x;\n"
+    "}\n"
+    "void main()\n"
+    "{\n"
+    "    uint i = gl_GlobalInvocationID.x;\n"
+    "    if (i >= amount)\n"
+    "        return;\n"
+    "    vec3 p = particles[i].positionLife.xyz;\n"
+    "    float l = particles[i].positionLife.w;\n"
+    "    if (i < rainCount)\n"
+    "    {\n"
+    "        l -= dt;\n"
+    "        if (l <= 0.0)\n"
+    "        {\n"
+    "            uint h = hash(i ^ hash(frame));\n"
+    "            p = vec3(0.0, float(h % 50u), 0.0);\n"
+    "            l = float(hash(h) % 10u);\n"
+    "        }\n"
+    "        p.y -= dt * 2.0;\n"
+    "    }\n"
+    "    l -= dt;\n"
+    "    if (l > 0.0)\n"
+    "    {\n"
+    "        p -= particles[i].velocity.xyz * dt * 2.0;\n"
+    "        particles[i].color.a -= dt;\n"
+    "    }\n"
+    "    particles[i].positionLife = vec4(p, l);\n"
+    "}\n";
+
+// Compute emission pass, every invocation appends one particle at the slot
+// handed out by the spawn counter (round robin over the pool). The CPU
+// restarts the counter below amount before every dispatch, so it never wraps.
+inline const char *shaderComputeEmit =
+    "#version 430 core\n"
+    "layout (local_size_x = 64) in;\n"
+    "struct Particle { vec4 positionLife; vec4 velocity; vec4 color; };\n"
+    "layout (std430, binding = 0) buffer Particles { Particle particles[]; };\n"
+    "layout (binding = 0, offset = 0) uniform atomic_uint spawnCursor;\n"
+    "uniform uint amount;\n"
+    "uniform uint spawnCount;\n"
+    "void main()\n"
+    "{\n"
+    "    if (gl_GlobalInvocationID.x >= spawnCount)\n"
+    "        return;\n"
+    "    uint slot = atomicCounterIncrement(spawnCursor) % amount;\n"
+    "    particles[slot].positionLife = vec4(0.0, 0.0, 0.0, 1.0);\n"
+    "    particles[slot].velocity = vec4(0.01, 0.01, 0.01, 0.0);\n"
+    "    particles[slot].color = vec4(1.0);\n"
+    "}\n";
+
+// Renders straight from the transform feedback buffer (or the compute
+// backend's SSBO), dead particles are moved outside the clip volume so they
+// never reach the rasterizer.
+inline const char *shaderFeedbackRender =
+    "#version 330 core\n"
+    "layout (location = 0) in vec4 vertex;\n"
+    "layout (location = 1) in vec3 offset;\n"
+    "layout (location = 2) in vec4 color;\n"
+    "layout (location = 3) in float life;\n"
+    "out vec2 TexCoords;\n"
+    "out vec4 ParticleColor;\n"
+    "uniform mat4 model;\n"
+    "uniform mat4 view;\n"
+    "uniform mat4 projection;\n"
+    "// GPU particles carry no sprite index and all draw the first atlas sprite\n"
+    "uniform vec4 spriteRects[64];\n"
+    "void main()\n"
+    "{\n"
+    "    TexCoords = spriteRects[0].xy + vertex.zw * spriteRects[0].zw;\n"
+    "    ParticleColor = color;\n"
+    "    vec4 pos_view = view * vec4(offset.xyz, 1.0);\n"
+    "    pos_view.xy += 4 * (vertex.xy - vec2(0.5));\n"
+    "    gl_Position = life > 0.0 ? projection * model * pos_view : vec4(2.0, 2.0, 2.0, 1.0);\n"
+    "}\n";
+
+// nuklear vertices of the overlay, positions in window pixels
+inline const char *shaderOverlayVertex =
+    "#version 330 core\n"
+    "layout (location = 0) in vec2 position;\n"
+    "layout (location = 1) in vec2 texCoord;\n"
+    "layout (location = 2) in vec4 color;\n"
+    "out vec2 TexCoords;\n"
+    "out vec4 OverlayColor;\n"
+    "uniform mat4 projection;\n"
+    "void main()\n"
+    "{\n"
+    "    TexCoords = texCoord;\n"
+    "    OverlayColor = color;\n"
+    "    gl_Position = projection * vec4(position, 0.0, 1.0);\n"
+    "}\n";
+
+inline const char *shaderOverlayFragment =
+    "#version 330 core\n"
+    "in vec2 TexCoords;\n"
+    "in vec4 OverlayColor;\n"
+    "out vec4 color;\n"
+    "uniform sampler2D glyphs;\n"
+    "void main()\n"
+    "{\n"
+    "    color = OverlayColor * texture(glyphs, TexCoords);\n"
+    "}\n";
+
+
+// FNV-1a hash of a uniform name
+constexpr uint32_t uniformHash(std::string_view name)
+{
+    uint32_t hash = 2166136261u;
+    for (char c : name)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Uniform name hashed at compile time, string literals convert implicitly:
+// shader.setUniformVec3("offset", value) does no string work at run time.
+struct UniformName
+{
+    consteval UniformName(const char *name) : hash(uniformHash(name)) {}
+
+    uint32_t hash;
+};
 
 enum TypeShader
 {
     VERTEX_SHADER = GL_VERTEX_SHADER,
     FRAGMENT_SHADER = GL_FRAGMENT_SHADER,
-    GEOMETRY_SHADER = GL_GEOMETRY_SHADER
+    GEOMETRY_SHADER = GL_GEOMETRY_SHADER,
+    COMPUTE_SHADER = GL_COMPUTE_SHADER
+};
+
+// programs the binary cache loaded or had to build, since the start
+struct ProgramCacheStats
+{
+    unsigned int loaded = 0;
+    unsigned int compiled = 0;
+    // binaries the driver refused, e.g. after an update that kept the version string
+    unsigned int rejected = 0;
+    double loadMs = 0.0;
+    double compileMs = 0.0;
+    // what the loaded programs took to compile when they were cached, minus loadMs
+    double savedMs = 0.0;
 };
 
 class Shader
@@ -108,42 +327,30 @@ class Shader
 public:
 
     Shader() : m_vertexShader(0), m_fragmentShader(0),
-        m_geometryShader(0), m_isVertexShader(false),
-        m_isFragmentShader(false), m_isGeometryShader(false), m_id(0)
+        m_geometryShader(0), m_computeShader(0), m_isVertexShader(false),
+        m_isFragmentShader(false), m_isGeometryShader(false),
+        m_isComputeShader(false), m_id(0)
     { }
 
     ~Shader() {}
 
-    void loadShader(const GLchar *shader, TypeShader type)
+    // where linked programs are kept as glGetProgramBinary blobs, so the next
+    // run skips compiling and linking; empty (the default) turns it off
+    static void setProgramCacheDirectory(const std::string &directory)
     {
-        if(type == TypeShader::VERTEX_SHADER)
-        {
-
-            m_vertexShader = glCreateShader(GL_VERTEX_SHADER);
-            //const GLchar *c_str = shader.c_str();
-            glShaderSource(m_vertexShader, 1, &shaderVertex, NULL);
-            glCompileShader(m_vertexShader);
-            shaderCompileStatus(m_vertexShader, __FILE__ , __LINE__);
-            m_isVertexShader = true;
-        }
+        s_programCacheDirectory = directory;
+    }
 
-        if(type == TypeShader::FRAGMENT_SHADER)
-        {
-            m_fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-            //const char *c_str = shader.c_str();
-            glShaderSource(m_fragmentShader, 1, &shaderFragment, NULL);
-            glCompileShader(m_fragmentShader);
-            shaderCompileStatus(m_fragmentShader, __FILE__ , __LINE__);
-            m_isFragmentShader = true;
-        }
+    static const ProgramCacheStats &getProgramCacheStats()
+    {
+        return s_programCacheStats;
+    }
 
-        if(type == TypeShader::GEOMETRY_SHADER)
-        {
-            m_geometryShader = glCreateShader(GL_GEOMETRY_SHADER);
-            glShaderSource(m_geometryShader, 1, &shaderGeometry, NULL);
-            glCompileShader(m_geometryShader);
-            m_isGeometryShader = true;
-        }
+    // the source is compiled by createShaderProgram, unless the program
+    // binary cache already has the linked program
+    void loadShader(const GLchar *shader, TypeShader type)
+    {
+        m_sources.emplace_back(type, shader);
     }
 
     void useShaderProgram()
@@ -156,10 +363,27 @@ public:
         return m_id;
     }
 
+    // vertex shader outputs captured by transform feedback, must be set before createShaderProgram
+    void setFeedbackVaryings(const std::vector<const GLchar*> &varyings)
+    {
+        m_feedbackVaryings = varyings;
+    }
+
     void createShaderProgram()
     {
+        const auto start = std::chrono::steady_clock::now();
         m_id = glCreateProgram();
 
+        const std::string cachePath = programCachePath();
+        if (!cachePath.empty() && loadProgramBinary(cachePath, start))
+        {
+            cacheUniformLocations();
+            return;
+        }
+
+        for (const auto &source : m_sources)
+            compileShader(source.second.c_str(), source.first);
+
         if(m_isVertexShader)
         {
             glAttachShader(m_id, m_vertexShader);
@@ -172,10 +396,29 @@ public:
         {
             glAttachShader(m_id, m_geometryShader);
         }
+        if(m_isComputeShader)
+        {
+            glAttachShader(m_id, m_computeShader);
+        }
+
 
+        if(!m_feedbackVaryings.empty())
+        {
+            glTransformFeedbackVaryings(m_id, static_cast<GLsizei>(m_feedbackVaryings.size()),
+                                        m_feedbackVaryings.data(), GL_INTERLEAVED_ATTRIBS);
+        }
 
+        if (!cachePath.empty())
+            glProgramParameteri(m_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
         glLinkProgram(m_id);
         programCompileStatus(m_id, __FILE__ , __LINE__);
+
+        const double compileMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        ++s_programCacheStats.compiled;
+        s_programCacheStats.compileMs += compileMs;
+        if (!cachePath.empty())
+            saveProgramBinary(cachePath, compileMs);
+        cacheUniformLocations();
     }
 
     /*const char *getShaderReader(const std::string &shader)
@@ -203,30 +446,252 @@ public:
         return source.c_str();
      }*/
 
-    void setUniformInt(const std::string &type, const GLint value)
+    // location resolved when the program was linked, -1 (ignored by glUniform*) if the
+    // uniform isn't active; a location can be kept as a handle and passed to glUniform* directly
+    GLint getUniformLocation(UniformName name) const
+    {
+        auto it = std::lower_bound(m_uniforms.begin(), m_uniforms.end(), name.hash,
+                                   [](const UniformSlot &slot, uint32_t hash) { return slot.hash < hash; });
+        return it != m_uniforms.end() && it->hash == name.hash ? it->location : -1;
+    }
+
+    void setUniformInt(UniformName type, const GLint value)
     {
-        glUniform1i(glGetUniformLocation(m_id, type.c_str()), value);
+        glUniform1i(getUniformLocation(type), value);
+    }
+
+    void setUniformFloat(UniformName type, const GLfloat value)
+    {
+        glUniform1f(getUniformLocation(type), value);
+    }
+
+    void setUniformUint(UniformName type, const GLuint value)
+    {
+        glUniform1ui(getUniformLocation(type), value);
+    }
+
+    void setUniformVec2(UniformName type, const glm::vec2 &value) {
+        glUniform2f(getUniformLocation(type), value.x, value.y);
+    }
+
+    void setUniformVec3(UniformName type, const glm::vec3 &value) {
+        glUniform3f(getUniformLocation(type), value.x, value.y, value.z);
     }
 
-    void setUniformVec2(const std::string &type, const glm::vec2 &value) {
-        glUniform2f(glGetUniformLocation(m_id, type.c_str()), value.x, value.y);
+    void setUniformVec4(UniformName type, const glm::vec4 &value) {
+        glUniform4f(getUniformLocation(type), value.x, value.y, value.z, value.w);
     }
 
-    void setUniformVec3(const std::string &type, const glm::vec3 &value) {
-        glUniform3f(glGetUniformLocation(m_id, type.c_str()), value.x, value.y, value.z);
+    void setUniformMatrix4x4(UniformName type, const glm::mat4 &matrix)
+    {
+        glUniformMatrix4fv(getUniformLocation(type), 1, GL_FALSE, &matrix[0][0]);
     }
 
-    void setUniformVec4(const std::string &type, const glm::vec4 &value) {
-        glUniform4f(glGetUniformLocation(m_id, type.c_str()), value.x, value.y, value.z, value.w);
+    // count elements of a vec4 array uniform, starting at element 0
+    void setUniformVec4Array(UniformName type, const glm::vec4 *values, GLsizei count)
+    {
+        glUniform4fv(getUniformLocation(type), count, &values[0].x);
     }
 
-    void setUniformMatrix4x4(const std::string &type, const glm::mat4 &matrix)
+    // glGetUniformLocation calls made by all shaders since the last call, i.e. per frame
+    // when called once a frame; only linking a program should ever cause any
+    static unsigned int takeUniformLocationQueries()
     {
-        glUniformMatrix4fv(glGetUniformLocation(m_id, type.c_str()), 1, GL_FALSE, &matrix[0][0]);
+        return s_uniformLocationQueries.exchange(0, std::memory_order_relaxed);
     }
 
 protected:
 
+    struct UniformSlot
+    {
+        uint32_t hash;
+        GLint location;
+    };
+
+    // resolve every active uniform once, after linking, into a table sorted by name hash
+    void cacheUniformLocations()
+    {
+        m_uniforms.clear();
+
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(m_id, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(m_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> name(maxLength > 0 ? maxLength : 1);
+        for (GLint i = 0; i < count; ++i)
+        {
+            GLint size;
+            GLenum type;
+            GLsizei length = 0;
+            glGetActiveUniform(m_id, i, static_cast<GLsizei>(name.size()), &length, &size, &type, name.data());
+
+            std::string_view uniform(name.data(), length);
+            GLint location = glGetUniformLocation(m_id, name.data());
+            s_uniformLocationQueries.fetch_add(1, std::memory_order_relaxed);
+            // uniform blocks and atomic counters have no location
+            if (location < 0)
+                continue;
+            // arrays are reported as "name[0]", look them up by "name"
+            if (uniform.size() > 3 && uniform.substr(uniform.size() - 3) == "[0]")
+                uniform.remove_suffix(3);
+            m_uniforms.push_back({uniformHash(uniform), location});
+        }
+
+        std::sort(m_uniforms.begin(), m_uniforms.end(),
+                  [](const UniformSlot &a, const UniformSlot &b) { return a.hash < b.hash; });
+        for (std::size_t i = 1; i < m_uniforms.size(); ++i)
+        {
+            if (m_uniforms[i].hash == m_uniforms[i - 1].hash)
+                std::cerr << "[WARN] Uniform name hash collision in program " << m_id << "\n";
+        }
+    }
+
+    void compileShader(const GLchar *shader, TypeShader type)
+    {
+        if(type == TypeShader::VERTEX_SHADER)
+        {
+
+            m_vertexShader = glCreateShader(GL_VERTEX_SHADER);
+            //const GLchar *c_str = shader.c_str();
+            glShaderSource(m_vertexShader, 1, &shader, NULL);
+            glCompileShader(m_vertexShader);
+            shaderCompileStatus(m_vertexShader, __FILE__ , __LINE__);
+            m_isVertexShader = true;
+        }
+
+        if(type == TypeShader::FRAGMENT_SHADER)
+        {
+            m_fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+            //const char *c_str = shader.c_str();
+            glShaderSource(m_fragmentShader, 1, &shader, NULL);
+            glCompileShader(m_fragmentShader);
+            shaderCompileStatus(m_fragmentShader, __FILE__ , __LINE__);
+            m_isFragmentShader = true;
+        }
+
+        if(type == TypeShader::GEOMETRY_SHADER)
+        {
+            m_geometryShader = glCreateShader(GL_GEOMETRY_SHADER);
+            glShaderSource(m_geometryShader, 1, &shader, NULL);
+            glCompileShader(m_geometryShader);
+            m_isGeometryShader = true;
+        }
+
+        if(type == TypeShader::COMPUTE_SHADER)
+        {
+            m_computeShader = glCreateShader(GL_COMPUTE_SHADER);
+            glShaderSource(m_computeShader, 1, &shader, NULL);
+            glCompileShader(m_computeShader);
+            shaderCompileStatus(m_computeShader, __FILE__ , __LINE__);
+            m_isComputeShader = true;
+        }
+    }
+
+    // layout of a program cache file, the glGetProgramBinary blob follows
+    struct ProgramBinaryHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t key;
+        uint32_t format;
+        uint32_t size;
+        double compileMs;
+    };
+
+    // <directory>/<key>.pbin, key hashing everything the binary depends
+    // on: the sources, the feedback varyings and the driver; empty if the
+    // cache is off or the driver has no binary formats
+    std::string programCachePath()
+    {
+        if (s_programCacheDirectory.empty())
+            return std::string();
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        if (formats == 0)
+            return std::string();
+
+        uint64_t key = hashBytes("program", 7);
+        for (const auto &source : m_sources)
+        {
+            const uint32_t type = source.first;
+            key = hashBytes(&type, sizeof(type), key);
+            key = hashBytes(source.second.c_str(), source.second.size() + 1, key);
+        }
+        for (const GLchar *varying : m_feedbackVaryings)
+            key = hashBytes(varying, std::strlen(varying) + 1, key);
+        for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+        {
+            const char *value = reinterpret_cast<const char*>(glGetString(name));
+            if (value)
+                key = hashBytes(value, std::strlen(value) + 1, key);
+        }
+        m_programKey = key;
+
+        char file[32];
+        snprintf(file, sizeof(file), "%016llx.pbin", static_cast<unsigned long long>(key));
+        return (std::filesystem::path(s_programCacheDirectory) / file).string();
+    }
+
+    // link m_id from the cached binary; false on a miss, or if the driver
+    // rejects it, then m_id is a fresh program to compile into
+    bool loadProgramBinary(const std::string &path, std::chrono::steady_clock::time_point start)
+    {
+        std::vector<unsigned char> file;
+        ProgramBinaryHeader header;
+        if (!readFile(path, file) || file.size() < sizeof(header))
+            return false;
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, "PBIN", 4) != 0 || header.version != programBinaryVersion ||
+            header.key != m_programKey || header.size != file.size() - sizeof(header))
+            return false;
+
+        glProgramBinary(m_id, header.format, file.data() + sizeof(header), static_cast<GLsizei>(header.size));
+        GLint linked = GL_FALSE;
+        glGetProgramiv(m_id, GL_LINK_STATUS, &linked);
+        if (!linked)
+        {
+            std::cerr << "[WARN] Program binary rejected by the driver, compiling: " << path << "\n";
+            ++s_programCacheStats.rejected;
+            glDeleteProgram(m_id);
+            m_id = glCreateProgram();
+            return false;
+        }
+
+        const double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        ++s_programCacheStats.loaded;
+        s_programCacheStats.loadMs += loadMs;
+        s_programCacheStats.savedMs += header.compileMs - loadMs;
+        std::cerr << "[INFO] Program loaded from binary cache in " << loadMs << " ms (compiling took "
+                  << header.compileMs << " ms) - File: " << path << "\n";
+        return true;
+    }
+
+    void saveProgramBinary(const std::string &path, double compileMs)
+    {
+        GLint linked = GL_FALSE, length = 0;
+        glGetProgramiv(m_id, GL_LINK_STATUS, &linked);
+        glGetProgramiv(m_id, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (!linked || length <= 0)
+            return;
+
+        std::vector<unsigned char> file(sizeof(ProgramBinaryHeader) + static_cast<std::size_t>(length));
+        GLenum format = 0;
+        GLsizei written = 0;
+        glGetProgramBinary(m_id, length, &written, &format, file.data() + sizeof(ProgramBinaryHeader));
+        if (written <= 0)
+            return;
+        ProgramBinaryHeader header = {};
+        std::memcpy(header.magic, "PBIN", 4);
+        header.version = programBinaryVersion;
+        header.key = m_programKey;
+        header.format = format;
+        header.size = static_cast<uint32_t>(written);
+        header.compileMs = compileMs;
+        std::memcpy(file.data(), &header, sizeof(header));
+        file.resize(sizeof(header) + static_cast<std::size_t>(written));
+        if (!writeFileAtomic(path, file.data(), file.size()))
+            std::cerr << "[WARN] Failed to write program binary: " << path << "\n";
+    }
+
     void shaderCompileStatus(GLuint shader, std::string file, int line)
     {
         GLint isCompiled;
@@ -291,10 +756,24 @@ private:
     GLuint m_vertexShader;
     GLuint m_fragmentShader;
     GLuint m_geometryShader;
+    GLuint m_computeShader;
 
     bool m_isVertexShader;
     bool m_isFragmentShader;
     bool m_isGeometryShader;
+    bool m_isComputeShader;
+
+    std::vector<const GLchar*> m_feedbackVaryings;
+    std::vector<UniformSlot> m_uniforms;
+    // loadShader sources in order, compiled only when the cache misses
+    std::vector<std::pair<TypeShader, std::string>> m_sources;
+    uint64_t m_programKey = 0;
+
+    inline static std::atomic<unsigned int> s_uniformLocationQueries{0};
+    // bump whenever ProgramBinaryHeader changes
+    static const uint32_t programBinaryVersion = 1;
+    inline static std::string s_programCacheDirectory;
+    inline static ProgramCacheStats s_programCacheStats;
 };
 
 
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "particlesimulation.h"
+#include "particledraw.h"
+
+// Render-ready copy of the alive particles, written by the simulation thread
+struct SimulationSnapshot
+{
+    std::vector<ParticleInstance> instances;
+    std::size_t count = 0;
+    // alive particles culling left out
+    std::size_t culled = 0;
+    // publish() call this snapshot answers, counted from 1
+    uint64_t frame = 0;
+};
+
+// Runs a ParticleSimulation on its own thread so that simulating frame N + 1
+// overlaps with rendering frame N: a frame costs max(update, render) instead
+// of their sum.
+//
+// The render thread only queues work. step() and spawn() go into a fixed
+// single-producer / single-consumer ring, publish() asks for a snapshot of
+// the state after them. Snapshots are exchanged through a triple buffer:
+// the simulation thread always has a slot to write, the render thread
+// always has a slot to read, and the third holds the newest finished one.
+// Handing a slot over is a single atomic exchange, so neither side ever
+// takes a lock; they only block (atomic wait, a futex) when the ring is
+// full or the render thread is more than one frame ahead.
+//
+// While the thread runs the simulation belongs to it, and so do the
+// parallelFor() calls of the job system it was given: don't touch the
+// simulation or run ranges on that pool from anywhere else. Background jobs
+// are fine, submit() takes its own lock, and the TextureLoader queues its
+// decodes on the same pool from the render thread.
+class SimulationThread
+{
+public:
+
+    explicit SimulationThread(ParticleSimulation &simulation) :
+        m_simulation(simulation)
+    {
+        for (SimulationSnapshot &slot : m_slots)
+            slot.instances.resize(simulation.getParticles().size());
+        m_thread = std::thread(&SimulationThread::run, this);
+    }
+
+    // finishes the queued work first
+    ~SimulationThread()
+    {
+        Command command;
+        command.type = CommandType::STOP;
+        push(command);
+        m_thread.join();
+    }
+
+    SimulationThread(const SimulationThread &) = delete;
+    SimulationThread &operator=(const SimulationThread &) = delete;
+
+    // queue ParticleSimulation::Update
+    void step(float dt, unsigned int newParticles, glm::vec3 offset)
+    {
+        Command command;
+        command.type = CommandType::STEP;
+        command.dt = dt;
+        command.count = newParticles;
+        command.offset = offset;
+        push(command);
+    }
+
+    // queue ParticleSimulation::AddParticles
+    void spawn(short int type, glm::vec3 position, glm::vec3 velocity, float rotation, unsigned int newParticles, glm::vec3 offset)
+    {
+        Command command;
+        command.type = CommandType::SPAWN;
+        command.particleType = type;
+        command.position = position;
+        command.velocity = velocity;
+        command.rotation = rotation;
+        command.count = newParticles;
+        command.offset = offset;
+        push(command);
+    }
+
+    // queue ParticleSimulation::setInterpolated
+    void setInterpolated(bool interpolated)
+    {
+        Command command;
+        command.type = CommandType::INTERPOLATE;
+        command.count = interpolated ? 1 : 0;
+        push(command);
+    }
+
+    // queue a snapshot of the state after everything queued so far, the
+    // particles DrawListBuilder picks for settings in their draw order
+    void publish(const DrawSettings &settings)
+    {
+        Command command;
+        command.type = CommandType::PUBLISH;
+        command.draw = settings;
+        push(command);
+        ++m_requested;
+    }
+
+    // newest finished snapshot, valid until the next acquire(). Waits only
+    // while the snapshot before the last publish() isn't done yet, so the
+    // render thread stays at most one frame ahead of the simulation
+    const SimulationSnapshot &acquire()
+    {
+        uint64_t published = m_published.load(std::memory_order_acquire);
+        while (published + 1 < m_requested)
+        {
+            m_published.wait(published, std::memory_order_acquire);
+            published = m_published.load(std::memory_order_acquire);
+        }
+        if (m_ready.load(std::memory_order_relaxed) & freshBit)
+            m_readSlot = m_ready.exchange(m_readSlot, std::memory_order_acq_rel) & slotMask;
+        return m_slots[m_readSlot];
+    }
+
+    // the snapshot the last acquire() returned
+    const SimulationSnapshot &current() const { return m_slots[m_readSlot]; }
+
+private:
+
+    enum class CommandType
+    {
+        STEP,
+        SPAWN,
+        INTERPOLATE,
+        PUBLISH,
+        STOP
+    };
+
+    struct Command
+    {
+        CommandType type = CommandType::STEP;
+        float dt = 0.0f;
+        float rotation = 0.0f;
+        short int particleType = 0;
+        unsigned int count = 0;
+        glm::vec3 offset = glm::vec3(0.0f);
+        glm::vec3 position = glm::vec3(0.0f);
+        glm::vec3 velocity = glm::vec3(0.0f);
+        DrawSettings draw;
+    };
+
+    static const std::size_t queueSize = 64;
+    static const unsigned int slotMask = 3;
+    static const unsigned int freshBit = 4;
+
+    // render thread side of the ring
+    void push(const Command &command)
+    {
+        const uint64_t head = m_head.load(std::memory_order_relaxed);
+        uint64_t tail = m_tail.load(std::memory_order_acquire);
+        while (head - tail == queueSize)
+        {
+            m_tail.wait(tail, std::memory_order_acquire);
+            tail = m_tail.load(std::memory_order_acquire);
+        }
+        m_queue[head % queueSize] = command;
+        m_head.store(head + 1, std::memory_order_release);
+        m_head.notify_one();
+    }
+
+    // simulation thread side of the ring
+    Command pop()
+    {
+        const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        uint64_t head = m_head.load(std::memory_order_acquire);
+        while (head == tail)
+        {
+            m_head.wait(head, std::memory_order_acquire);
+            head = m_head.load(std::memory_order_acquire);
+        }
+        Command command = m_queue[tail % queueSize];
+        m_tail.store(tail + 1, std::memory_order_release);
+        m_tail.notify_one();
+        return command;
+    }
+
+    void run()
+    {
+        for (;;)
+        {
+            const Command command = pop();
+            switch (command.type)
+            {
+            case CommandType::STEP:
+                m_simulation.Update(command.dt, command.count, command.offset);
+                break;
+            case CommandType::SPAWN:
+                m_simulation.AddParticles(command.particleType, command.position, command.velocity, command.rotation, command.count, command.offset);
+                break;
+            case CommandType::INTERPOLATE:
+                m_simulation.setInterpolated(command.count != 0);
+                break;
+            case CommandType::PUBLISH:
+                writeSnapshot(command);
+                break;
+            case CommandType::STOP:
+                return;
+            }
+        }
+    }
+
+    void writeSnapshot(const Command &publish)
+    {
+        SimulationSnapshot &snapshot = m_slots[m_writeSlot];
+        const DrawList list = m_drawListBuilder.build(m_simulation, publish.draw);
+        DrawListBuilder::writeInstances(snapshot.instances.data(), m_simulation.getAliveParticles(), list, publish.draw.alpha,
+                                        m_simulation.getJobSystem(), m_simulation.getGrainSize());
+        snapshot.count = list.count;
+        snapshot.culled = list.culled;
+        snapshot.frame = m_published.load(std::memory_order_relaxed) + 1;
+
+        // hand the slot over and take whichever the render thread isn't reading
+        m_writeSlot = m_ready.exchange(m_writeSlot | freshBit, std::memory_order_acq_rel) & slotMask;
+        m_published.fetch_add(1, std::memory_order_release);
+        m_published.notify_one();
+    }
+
+    ParticleSimulation &m_simulation;
+    DrawListBuilder m_drawListBuilder;
+    std::thread m_thread;
+
+    Command m_queue[queueSize];
+    // commands pushed and popped so far, on their own cache lines
+    alignas(64) std::atomic<uint64_t> m_head{0};
+    alignas(64) std::atomic<uint64_t> m_tail{0};
+
+    SimulationSnapshot m_slots[3];
+    // slot of the newest finished snapshot, freshBit until the reader takes it
+    alignas(64) std::atomic<unsigned int> m_ready{1};
+    // snapshots finished by the simulation thread
+    alignas(64) std::atomic<uint64_t> m_published{0};
+    // owned by the simulation thread
+    unsigned int m_writeSlot = 2;
+    // owned by the render thread
+    unsigned int m_readSlot = 0;
+    uint64_t m_requested = 0;
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef>
+#include <GL/glew.h>
+
+// Triple-buffered streaming buffer. The GL buffer is split into three
+// regions written round robin, one per frame; a fence placed after the draw
+// that reads a region has to signal before the region is written again, so
+// the CPU never overwrites data the GPU is still using and the driver never
+// has to orphan or synchronise.
+//
+// With ARB_buffer_storage the whole buffer is mapped once, persistent and
+// coherent, otherwise every region is mapped unsynchronized for the frame.
+class StreamBuffer
+{
+public:
+
+    static const unsigned int regionCount = 3;
+
+    StreamBuffer() {}
+
+    ~StreamBuffer()
+    {
+        if (m_buffer == 0)
+            return;
+        for (unsigned int i = 0; i < regionCount; ++i)
+            glDeleteSync(m_fences[i]);
+        if (m_persistent)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+        glDeleteBuffers(1, &m_buffer);
+    }
+
+    StreamBuffer(const StreamBuffer &) = delete;
+    StreamBuffer &operator=(const StreamBuffer &) = delete;
+
+    // allocate regionCount regions of regionSize bytes each
+    void Initialize(std::size_t regionSize)
+    {
+        m_regionSize = regionSize;
+        const GLsizeiptr size = static_cast<GLsizeiptr>(regionSize * regionCount);
+
+        glGenBuffers(1, &m_buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+        m_persistent = GLEW_ARB_buffer_storage;
+        if (m_persistent)
+        {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_ARRAY_BUFFER, size, nullptr, flags);
+            m_mapped = static_cast<char*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags));
+        }
+        else
+        {
+            glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // advance to the next region and return it for writing, waits for the GPU
+    // only if it is still reading that region from three frames ago
+    void *map()
+    {
+        m_region = (m_region + 1) % regionCount;
+        waitFence(m_region);
+
+        if (m_persistent)
+            return m_mapped + getOffset();
+
+        glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+        void *region = glMapBufferRange(GL_ARRAY_BUFFER, getOffset(), m_regionSize,
+                                        GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        m_regionMapped = region != nullptr;
+        return region;
+    }
+
+    // done writing the current region; nothing to do if map() returned null
+    void unmap()
+    {
+        if (m_persistent || !m_regionMapped)
+            return;
+        m_regionMapped = false;
+        glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // call after the last draw that reads the current region
+    void fence()
+    {
+        glDeleteSync(m_fences[m_region]);
+        m_fences[m_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    GLuint getBuffer() const { return m_buffer; }
+    std::size_t getRegionSize() const { return m_regionSize; }
+    // byte offset of the current region inside getBuffer()
+    std::size_t getOffset() const { return m_region * m_regionSize; }
+    bool isPersistent() const { return m_persistent; }
+
+private:
+
+    void waitFence(unsigned int region)
+    {
+        if (!m_fences[region])
+            return;
+        GLbitfield flags = 0;
+        for (;;)
+        {
+            GLenum result = glClientWaitSync(m_fences[region], flags, 1000000);
+            if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED)
+                break;
+            // make sure the fence actually gets submitted before waiting again
+            flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        }
+        glDeleteSync(m_fences[region]);
+        m_fences[region] = 0;
+    }
+
+    GLuint m_buffer = 0;
+    GLsync m_fences[regionCount] = {0, 0, 0};
+    std::size_t m_regionSize = 0;
+    unsigned int m_region = 0;
+    char *m_mapped = nullptr;
+    bool m_persistent = false;
+    // the non-persistent map() of the current region succeeded
+    bool m_regionMapped = false;
+};
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <glm/glm.hpp>
+
+#include "binaryfile.h"
+#include "mipchain.h"
+
+// read-only mapping of a whole file, unmapped with the object
+class MappedFile
+{
+public:
+
+    MappedFile() {}
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool open(const std::string &path)
+    {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            void *data = mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                m_data = static_cast<const unsigned char*>(data);
+                m_size = static_cast<std::size_t>(info.st_size);
+            }
+        }
+        // the mapping stays valid without the descriptor
+        ::close(fd);
+        return m_data != nullptr;
+    }
+
+    void close()
+    {
+        if (m_data)
+            munmap(const_cast<unsigned char*>(m_data), m_size);
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    const unsigned char *data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+
+private:
+
+    const unsigned char *m_data = nullptr;
+    std::size_t m_size = 0;
+};
+
+// Decoded, mip-chained textures on disk, one <key>.ptex file per source
+// image or atlas under directory. The file is a header, the level table,
+// the atlas sprite rects and then the texels of all levels exactly as they
+// go to glTexImage2D, so a hit is an mmap and no decode or mip generation.
+// The key hashes the source files' bytes, editing a sprite misses on its own.
+class TextureCache
+{
+public:
+
+    // bump whenever the layout or the mip filter changes
+    static const uint32_t version = 1;
+
+    struct Entry
+    {
+        MappedFile file;
+        int channels = 0;
+        std::vector<MipLevel> levels;
+        std::vector<glm::vec4> rects;
+        // the mip chain inside file
+        const unsigned char *texels = nullptr;
+        std::size_t size = 0;
+    };
+
+    explicit TextureCache(const std::string &directory) : m_directory(directory) {}
+
+    const std::string &getDirectory() const { return m_directory; }
+
+    std::string path(uint64_t key) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.ptex", static_cast<unsigned long long>(key));
+        return (std::filesystem::path(m_directory) / name).string();
+    }
+
+    // map the entry of key, false on a miss or a file that doesn't check out
+    bool read(uint64_t key, Entry &entry) const
+    {
+        if (!entry.file.open(path(key)))
+            return false;
+        if (!check(key, entry))
+        {
+            entry.file.close();
+            return false;
+        }
+        return true;
+    }
+
+    // store a mip chain under key, see writeFileAtomic
+    bool write(uint64_t key, int channels, const std::vector<MipLevel> &levels, const std::vector<glm::vec4> &rects,
+               const unsigned char *texels, std::size_t size) const
+    {
+        Header header = {};
+        std::memcpy(header.magic, "PTEX", 4);
+        header.version = version;
+        header.key = key;
+        header.channels = static_cast<uint32_t>(channels);
+        header.levelCount = static_cast<uint32_t>(levels.size());
+        header.rectCount = static_cast<uint32_t>(rects.size());
+        // texel data on a 16 byte boundary of the mapping
+        const std::size_t tableEnd = sizeof(Header) + levels.size() * sizeof(Level) + rects.size() * sizeof(glm::vec4);
+        header.payloadOffset = (tableEnd + 15) & ~std::size_t(15);
+        header.payloadSize = size;
+
+        // the padding up to the payload stays zero
+        std::vector<unsigned char> file(header.payloadOffset + size, 0);
+        unsigned char *out = file.data();
+        std::memcpy(out, &header, sizeof(Header));
+        out += sizeof(Header);
+        for (const MipLevel &level : levels)
+        {
+            const Level stored = { static_cast<uint32_t>(level.width), static_cast<uint32_t>(level.height), level.offset };
+            std::memcpy(out, &stored, sizeof(Level));
+            out += sizeof(Level);
+        }
+        if (!rects.empty())
+            std::memcpy(out, rects.data(), rects.size() * sizeof(glm::vec4));
+        if (size > 0)
+            std::memcpy(file.data() + header.payloadOffset, texels, size);
+        return writeFileAtomic(path(key), file.data(), file.size());
+    }
+
+private:
+
+    // parse the mapped file of entry; every count and offset is checked
+    // against the mapping before it is used, a foreign or corrupt file must
+    // not send a read past its end
+    static bool check(uint64_t key, Entry &entry)
+    {
+        const unsigned char *data = entry.file.data();
+        const std::size_t size = entry.file.size();
+
+        Header header;
+        if (size < sizeof(Header))
+            return false;
+        std::memcpy(&header, data, sizeof(Header));
+        if (std::memcmp(header.magic, "PTEX", 4) != 0 || header.version != version || header.key != key ||
+            header.channels < 1 || header.channels > 4)
+            return false;
+
+        // the tables must fit the file, counted without overflow
+        const std::size_t available = size - sizeof(Header);
+        if (header.levelCount == 0 || header.levelCount > available / sizeof(Level))
+            return false;
+        const std::size_t levelTable = header.levelCount * sizeof(Level);
+        if (header.rectCount > (available - levelTable) / sizeof(glm::vec4))
+            return false;
+        const std::size_t tableEnd = sizeof(Header) + levelTable + header.rectCount * sizeof(glm::vec4);
+        if (header.payloadOffset < tableEnd || header.payloadOffset > size || header.payloadSize != size - header.payloadOffset)
+            return false;
+
+        // the levels must be the chain mipChainLevels builds for level 0, filling the payload
+        const int channels = static_cast<int>(header.channels);
+        const unsigned char *table = data + sizeof(Header);
+        Level stored;
+        std::memcpy(&stored, table, sizeof(Level));
+        if (stored.width == 0 || stored.height == 0 || stored.width > maxSize || stored.height > maxSize)
+            return false;
+        std::vector<MipLevel> expected;
+        const std::size_t chainSize = mipChainLevels(static_cast<int>(stored.width), static_cast<int>(stored.height), channels, expected);
+        if (expected.size() != header.levelCount || chainSize != header.payloadSize)
+            return false;
+        for (const MipLevel &level : expected)
+        {
+            std::memcpy(&stored, table, sizeof(Level));
+            table += sizeof(Level);
+            if (static_cast<int>(stored.width) != level.width || static_cast<int>(stored.height) != level.height ||
+                stored.offset != level.offset)
+                return false;
+        }
+
+        entry.channels = channels;
+        entry.levels = std::move(expected);
+        entry.rects.resize(header.rectCount);
+        if (header.rectCount > 0)
+            std::memcpy(entry.rects.data(), table, header.rectCount * sizeof(glm::vec4));
+        entry.texels = data + header.payloadOffset;
+        entry.size = static_cast<std::size_t>(header.payloadSize);
+        return true;
+    }
+
+    // largest side of a cached texture, far beyond any GL_MAX_TEXTURE_SIZE
+    static const uint32_t maxSize = 1u << 16;
+
+    // fixed size fields only, the file is read on the machine that wrote it
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t key;
+        uint32_t channels;
+        uint32_t levelCount;
+        uint32_t rectCount;
+        uint32_t reserved;
+        uint64_t payloadOffset;
+        uint64_t payloadSize;
+    };
+
+    struct Level
+    {
+        uint32_t width, height;
+        uint64_t offset;
+    };
+
+    std::string m_directory;
+};
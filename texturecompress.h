@@ -0,0 +1,523 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "mipchain.h"
+
+// GL-free block compression of sprites for GPUs, and the KTX 1 container the
+// compressed mip chains are shipped in. Two families are written:
+//   RGTC (BC4 one channel, BC5 two channels), core since GL 3.0, for the
+//   grayscale sprites like smoke, 0.5 or 1 byte a texel;
+//   BPTC (BC7, mode 6 only), GL 4.2 or ARB_texture_compression_bptc, for
+//   color sprites, 1 byte a texel. Every BC7 sprite gets an RGTC companion
+//   next to it, its luminance and alpha in BC5, that contexts without BPTC
+//   load instead: the color is lost, the shape and the shading are kept.
+// Sprites are stored in as few channels as they need and a swizzle, kept in
+// the KTXswizzle key, maps them back to RGBA when the texture is created.
+
+// internal formats as GL defines them, without needing GL headers
+enum class BlockFormat : uint32_t
+{
+    BC4 = 0x8DBB, // GL_COMPRESSED_RED_RGTC1
+    BC5 = 0x8DBD, // GL_COMPRESSED_RG_RGTC2
+    BC7 = 0x8E8C  // GL_COMPRESSED_RGBA_BPTC_UNORM
+};
+
+inline const char *blockFormatName(BlockFormat format)
+{
+    switch (format)
+    {
+    case BlockFormat::BC4: return "BC4";
+    case BlockFormat::BC5: return "BC5";
+    case BlockFormat::BC7: return "BC7";
+    }
+    return "unknown";
+}
+
+// bytes of one 4x4 block
+inline std::size_t blockBytes(BlockFormat format)
+{
+    return format == BlockFormat::BC4 ? 8 : 16;
+}
+
+inline std::size_t compressedLevelSize(BlockFormat format, int width, int height)
+{
+    return static_cast<std::size_t>((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+// how an RGBA sprite is best stored: the channels the format keeps and the
+// swizzle that rebuilds RGBA from them (r, g, b, a, 0 or 1 per component)
+struct SpriteEncoding
+{
+    BlockFormat format;
+    // source channel of every stored channel, 0-3 for RGBA
+    int channels[2];
+    const char *swizzle;
+};
+
+// look at an RGBA image: gray with a constant white color is alpha only
+// (BC4), gray with alpha two channels (BC5), gray and opaque one (BC4),
+// anything with color BC7. tolerance is the color difference still gray.
+inline SpriteEncoding classifySprite(const unsigned char *rgba, int width, int height, int tolerance = 8)
+{
+    bool gray = true, opaque = true, white = true;
+    for (std::size_t i = 0; i < static_cast<std::size_t>(width) * height; ++i)
+    {
+        const unsigned char *texel = rgba + 4 * i;
+        if (std::abs(texel[0] - texel[1]) > tolerance || std::abs(texel[1] - texel[2]) > tolerance)
+            gray = false;
+        if (texel[3] != 255)
+            opaque = false;
+        // fully transparent texels don't show, whatever their color
+        if (texel[3] != 0 && texel[0] < 255 - tolerance)
+            white = false;
+    }
+    if (!gray)
+        return { BlockFormat::BC7, { 0, 1 }, "rgba" };
+    if (opaque)
+        return { BlockFormat::BC4, { 0, 0 }, "rrr1" };
+    if (white)
+        return { BlockFormat::BC4, { 3, 3 }, "111r" };
+    return { BlockFormat::BC5, { 0, 3 }, "rrrg" };
+}
+
+// the RGTC stand-in of a color sprite: luminance in red, alpha in green
+inline const SpriteEncoding rgtcFallbackEncoding = { BlockFormat::BC5, { 0, 3 }, "rrrg" };
+
+// where the RGTC companion of the BC7 sprite at path lives, x.ktx -> x.rgtc.ktx
+inline std::string rgtcFallbackPath(const std::string &path)
+{
+    const std::string extension = ".ktx";
+    if (path.size() >= extension.size() && path.compare(path.size() - extension.size(), extension.size(), extension) == 0)
+        return path.substr(0, path.size() - extension.size()) + ".rgtc" + extension;
+    return path + ".rgtc" + extension;
+}
+
+// gray copy of an RGBA image, Rec. 709 luminance in RGB and alpha kept;
+// what rgtcFallbackEncoding compresses
+inline std::vector<unsigned char> luminanceImage(const unsigned char *rgba, std::size_t texels)
+{
+    std::vector<unsigned char> gray(rgba, rgba + texels * 4);
+    for (std::size_t i = 0; i < texels; ++i)
+    {
+        unsigned char *texel = gray.data() + 4 * i;
+        const int luminance = (54 * texel[0] + 183 * texel[1] + 19 * texel[2] + 128) >> 8;
+        texel[0] = texel[1] = texel[2] = static_cast<unsigned char>(luminance);
+    }
+    return gray;
+}
+
+// 4x4 block at bx, by of an RGBA image, edge texels repeated past the border
+inline void loadBlock(const unsigned char *rgba, int width, int height, int bx, int by, unsigned char block[16][4])
+{
+    for (int y = 0; y < 4; ++y)
+    {
+        const int sy = std::min(by * 4 + y, height - 1);
+        for (int x = 0; x < 4; ++x)
+        {
+            const int sx = std::min(bx * 4 + x, width - 1);
+            std::memcpy(block[y * 4 + x], rgba + (static_cast<std::size_t>(sy) * width + sx) * 4, 4);
+        }
+    }
+}
+
+// BC4: two 8 bit endpoints and a 3 bit index per texel into the 8 values
+// interpolated between them
+inline void encodeBC4Block(const unsigned char values[16], unsigned char out[8])
+{
+    unsigned char high = 0, low = 255;
+    for (int i = 0; i < 16; ++i)
+    {
+        high = std::max(high, values[i]);
+        low = std::min(low, values[i]);
+    }
+    out[0] = high;
+    out[1] = low;
+    uint64_t indices = 0;
+    if (high != low)
+    {
+        // palette order is high, low, then 6 steps from high to low
+        int palette[8] = { high, low };
+        for (int i = 1; i < 7; ++i)
+            palette[i + 1] = ((7 - i) * high + i * low + 3) / 7;
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 0, bestError = 256;
+            for (int p = 0; p < 8; ++p)
+            {
+                const int error = std::abs(palette[p] - values[i]);
+                if (error < bestError)
+                {
+                    best = p;
+                    bestError = error;
+                }
+            }
+            indices |= static_cast<uint64_t>(best) << (3 * i);
+        }
+    }
+    for (int i = 0; i < 6; ++i)
+        out[2 + i] = static_cast<unsigned char>(indices >> (8 * i));
+}
+
+inline void decodeBC4Block(const unsigned char in[8], unsigned char values[16])
+{
+    const int high = in[0], low = in[1];
+    int palette[8] = { high, low };
+    if (high > low)
+    {
+        for (int i = 1; i < 7; ++i)
+            palette[i + 1] = ((7 - i) * high + i * low + 3) / 7;
+    }
+    else
+    {
+        for (int i = 1; i < 5; ++i)
+            palette[i + 1] = ((5 - i) * high + i * low + 2) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+    uint64_t indices = 0;
+    for (int i = 0; i < 6; ++i)
+        indices |= static_cast<uint64_t>(in[2 + i]) << (8 * i);
+    for (int i = 0; i < 16; ++i)
+        values[i] = static_cast<unsigned char>(palette[(indices >> (3 * i)) & 7]);
+}
+
+// 128 bit block, written and read LSB first as BC7 lays out its fields
+struct BlockBits
+{
+    unsigned char bytes[16] = {};
+    int position = 0;
+
+    void write(uint32_t value, int bits)
+    {
+        for (int i = 0; i < bits; ++i, ++position)
+            bytes[position / 8] |= static_cast<unsigned char>(((value >> i) & 1) << (position % 8));
+    }
+
+    uint32_t read(int bits)
+    {
+        uint32_t value = 0;
+        for (int i = 0; i < bits; ++i, ++position)
+            value |= static_cast<uint32_t>((bytes[position / 8] >> (position % 8)) & 1) << i;
+        return value;
+    }
+};
+
+// interpolation weights of 4 bit BC7 indices, out of 64
+inline const int bc7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// BC7 mode 6: one subset, RGBA endpoints of 7 bits plus a shared low bit
+// each and a 4 bit index per texel. The endpoints are the extremes of the
+// block along its principal axis, good enough for soft particle sprites.
+inline void encodeBC7Block(const unsigned char block[16][4], unsigned char out[16])
+{
+    float mean[4] = {};
+    for (int i = 0; i < 16; ++i)
+        for (int c = 0; c < 4; ++c)
+            mean[c] += block[i][c] / 16.0f;
+    float covariance[4][4] = {};
+    for (int i = 0; i < 16; ++i)
+        for (int a = 0; a < 4; ++a)
+            for (int b = 0; b < 4; ++b)
+                covariance[a][b] += (block[i][a] - mean[a]) * (block[i][b] - mean[b]);
+    // principal axis by power iteration, starting on the diagonal
+    float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    for (int iteration = 0; iteration < 8; ++iteration)
+    {
+        float next[4] = {};
+        for (int a = 0; a < 4; ++a)
+            for (int b = 0; b < 4; ++b)
+                next[a] += covariance[a][b] * axis[b];
+        const float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2] + next[3] * next[3]);
+        if (length < 1e-6f)
+            break;
+        for (int c = 0; c < 4; ++c)
+            axis[c] = next[c] / length;
+    }
+    float low = 0.0f, high = 0.0f;
+    for (int i = 0; i < 16; ++i)
+    {
+        float projection = 0.0f;
+        for (int c = 0; c < 4; ++c)
+            projection += (block[i][c] - mean[c]) * axis[c];
+        low = std::min(low, projection);
+        high = std::max(high, projection);
+    }
+
+    // quantize both endpoints to 7 bits and the p-bit that fits them best
+    int endpoints[2][4], pbits[2];
+    for (int e = 0; e < 2; ++e)
+    {
+        const float t = e == 0 ? low : high;
+        int bestError = 1 << 30;
+        for (int p = 0; p < 2; ++p)
+        {
+            int quantized[4], error = 0;
+            for (int c = 0; c < 4; ++c)
+            {
+                const float value = std::clamp(mean[c] + axis[c] * t, 0.0f, 255.0f);
+                quantized[c] = std::clamp(static_cast<int>(std::lround((value - p) / 2.0f)), 0, 127);
+                const int restored = (quantized[c] << 1) | p;
+                error += static_cast<int>((restored - value) * (restored - value));
+            }
+            if (error < bestError)
+            {
+                bestError = error;
+                pbits[e] = p;
+                std::memcpy(endpoints[e], quantized, sizeof(quantized));
+            }
+        }
+    }
+
+    int palette[16][4];
+    for (int i = 0; i < 16; ++i)
+        for (int c = 0; c < 4; ++c)
+        {
+            const int e0 = (endpoints[0][c] << 1) | pbits[0];
+            const int e1 = (endpoints[1][c] << 1) | pbits[1];
+            palette[i][c] = ((64 - bc7Weights4[i]) * e0 + bc7Weights4[i] * e1 + 32) >> 6;
+        }
+    int indices[16];
+    for (int i = 0; i < 16; ++i)
+    {
+        int bestError = 1 << 30;
+        for (int p = 0; p < 16; ++p)
+        {
+            int error = 0;
+            for (int c = 0; c < 4; ++c)
+                error += (palette[p][c] - block[i][c]) * (palette[p][c] - block[i][c]);
+            if (error < bestError)
+            {
+                bestError = error;
+                indices[i] = p;
+            }
+        }
+    }
+    // the first index drops its top bit, so it has to be below 8
+    if (indices[0] >= 8)
+    {
+        std::swap(endpoints[0], endpoints[1]);
+        std::swap(pbits[0], pbits[1]);
+        for (int &index : indices)
+            index = 15 - index;
+    }
+
+    BlockBits bits;
+    bits.write(1 << 6, 7);
+    for (int c = 0; c < 4; ++c)
+    {
+        bits.write(endpoints[0][c], 7);
+        bits.write(endpoints[1][c], 7);
+    }
+    bits.write(pbits[0], 1);
+    bits.write(pbits[1], 1);
+    for (int i = 0; i < 16; ++i)
+        bits.write(indices[i], i == 0 ? 3 : 4);
+    std::memcpy(out, bits.bytes, 16);
+}
+
+// decodes what encodeBC7Block writes (mode 6), other modes come out black
+inline void decodeBC7Block(const unsigned char in[16], unsigned char block[16][4])
+{
+    BlockBits bits;
+    std::memcpy(bits.bytes, in, 16);
+    if (bits.read(7) != (1 << 6))
+    {
+        std::memset(block, 0, 16 * 4);
+        return;
+    }
+    int endpoints[2][4];
+    for (int c = 0; c < 4; ++c)
+    {
+        endpoints[0][c] = static_cast<int>(bits.read(7));
+        endpoints[1][c] = static_cast<int>(bits.read(7));
+    }
+    const int p0 = static_cast<int>(bits.read(1));
+    const int p1 = static_cast<int>(bits.read(1));
+    for (int i = 0; i < 16; ++i)
+    {
+        const int weight = bc7Weights4[bits.read(i == 0 ? 3 : 4)];
+        for (int c = 0; c < 4; ++c)
+        {
+            const int e0 = (endpoints[0][c] << 1) | p0;
+            const int e1 = (endpoints[1][c] << 1) | p1;
+            block[i][c] = static_cast<unsigned char>(((64 - weight) * e0 + weight * e1 + 32) >> 6);
+        }
+    }
+}
+
+// compress one RGBA level, the blocks row by row
+inline void compressLevel(const unsigned char *rgba, int width, int height, const SpriteEncoding &encoding, unsigned char *out)
+{
+    const int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    for (int by = 0; by < blocksY; ++by)
+        for (int bx = 0; bx < blocksX; ++bx)
+        {
+            unsigned char block[16][4];
+            loadBlock(rgba, width, height, bx, by, block);
+            if (encoding.format == BlockFormat::BC7)
+            {
+                encodeBC7Block(block, out);
+            }
+            else
+            {
+                const int planes = encoding.format == BlockFormat::BC5 ? 2 : 1;
+                for (int plane = 0; plane < planes; ++plane)
+                {
+                    unsigned char values[16];
+                    for (int i = 0; i < 16; ++i)
+                        values[i] = block[i][encoding.channels[plane]];
+                    encodeBC4Block(values, out + 8 * plane);
+                }
+            }
+            out += blockBytes(encoding.format);
+        }
+}
+
+// the RGBA a GPU samples from a compressed level, swizzle applied
+inline void decompressLevel(const unsigned char *data, int width, int height, const SpriteEncoding &encoding, unsigned char *rgba)
+{
+    const int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    for (int by = 0; by < blocksY; ++by)
+        for (int bx = 0; bx < blocksX; ++bx)
+        {
+            unsigned char block[16][4];
+            if (encoding.format == BlockFormat::BC7)
+            {
+                decodeBC7Block(data, block);
+            }
+            else
+            {
+                unsigned char planes[2][16] = {};
+                decodeBC4Block(data, planes[0]);
+                if (encoding.format == BlockFormat::BC5)
+                    decodeBC4Block(data + 8, planes[1]);
+                for (int i = 0; i < 16; ++i)
+                    for (int c = 0; c < 4; ++c)
+                    {
+                        const char source = encoding.swizzle[c];
+                        block[i][c] = source == '1' ? 255 : source == '0' ? 0 : planes[source == 'g' ? 1 : 0][i];
+                    }
+            }
+            data += blockBytes(encoding.format);
+            for (int y = 0; y < 4 && by * 4 + y < height; ++y)
+                for (int x = 0; x < 4 && bx * 4 + x < width; ++x)
+                    std::memcpy(rgba + (static_cast<std::size_t>(by * 4 + y) * width + bx * 4 + x) * 4, block[y * 4 + x], 4);
+        }
+}
+
+// A KTX 1 file of a compressed 2D texture with its mip chain
+// (khronos.org/ktx). Only the fields a 2D block compressed texture uses.
+struct KtxImage
+{
+    uint32_t internalFormat = 0;
+    int width = 0, height = 0;
+    std::string swizzle = "rgba";
+    // level i starts at data + levels[i].offset, compressedLevelSize bytes long
+    std::vector<MipLevel> levels;
+    std::vector<unsigned char> data;
+};
+
+inline const unsigned char ktxIdentifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+// layout of the KTX 1 file for image, levels packed one after the other in data
+inline std::vector<unsigned char> writeKtx(const KtxImage &image)
+{
+    const uint32_t baseFormat = image.internalFormat == static_cast<uint32_t>(BlockFormat::BC4) ? 0x1903 // GL_RED
+                              : image.internalFormat == static_cast<uint32_t>(BlockFormat::BC5) ? 0x8227 // GL_RG
+                              : 0x1908; // GL_RGBA
+    // one key/value pair, the swizzle, NUL terminated and padded to 4 bytes
+    const std::string key = "KTXswizzle";
+    const uint32_t pairSize = static_cast<uint32_t>(key.size() + 1 + image.swizzle.size() + 1);
+    const uint32_t pairPadded = (pairSize + 3) & ~3u;
+    const uint32_t header[13] = { 0x04030201, 0, 1, 0, image.internalFormat, baseFormat,
+                                  static_cast<uint32_t>(image.width), static_cast<uint32_t>(image.height), 0, 0, 1,
+                                  static_cast<uint32_t>(image.levels.size()), 4 + pairPadded };
+
+    std::vector<unsigned char> file(ktxIdentifier, ktxIdentifier + sizeof(ktxIdentifier));
+    auto append = [&file](const void *data, std::size_t size) {
+        const std::size_t at = file.size();
+        file.resize(at + size);
+        std::memcpy(file.data() + at, data, size);
+    };
+    append(header, sizeof(header));
+    append(&pairSize, 4);
+    append(key.c_str(), key.size() + 1);
+    append(image.swizzle.c_str(), image.swizzle.size() + 1);
+    file.resize(file.size() + pairPadded - pairSize, 0);
+    const BlockFormat format = static_cast<BlockFormat>(image.internalFormat);
+    for (const MipLevel &level : image.levels)
+    {
+        const uint32_t size = static_cast<uint32_t>(compressedLevelSize(format, level.width, level.height));
+        append(&size, 4);
+        append(image.data.data() + level.offset, size);
+    }
+    return file;
+}
+
+// parse a KTX 1 file written by writeKtx (or any compressed 2D one), false
+// for anything else
+inline bool readKtx(const std::vector<unsigned char> &file, KtxImage &image)
+{
+    uint32_t header[13];
+    if (file.size() < sizeof(ktxIdentifier) + sizeof(header) ||
+        std::memcmp(file.data(), ktxIdentifier, sizeof(ktxIdentifier)) != 0)
+        return false;
+    std::memcpy(header, file.data() + sizeof(ktxIdentifier), sizeof(header));
+    const uint32_t internalFormat = header[4];
+    // native byte order, compressed (glType 0), 2D, one face
+    if (header[0] != 0x04030201 || header[1] != 0 || header[8] > 1 || header[9] > 1 || header[10] != 1 ||
+        (internalFormat != static_cast<uint32_t>(BlockFormat::BC4) && internalFormat != static_cast<uint32_t>(BlockFormat::BC5) &&
+         internalFormat != static_cast<uint32_t>(BlockFormat::BC7)))
+        return false;
+
+    image.internalFormat = internalFormat;
+    image.width = static_cast<int>(header[6]);
+    image.height = static_cast<int>(header[7]);
+    std::size_t position = sizeof(ktxIdentifier) + sizeof(header);
+    const std::size_t keyValueEnd = position + header[12];
+    if (keyValueEnd > file.size())
+        return false;
+    while (position + 4 <= keyValueEnd)
+    {
+        uint32_t pairSize;
+        std::memcpy(&pairSize, file.data() + position, 4);
+        position += 4;
+        if (pairSize > keyValueEnd - position)
+            return false;
+        const char *pair = reinterpret_cast<const char*>(file.data() + position);
+        const std::string key(pair, strnlen(pair, pairSize));
+        if (key == "KTXswizzle" && key.size() + 1 < pairSize)
+            image.swizzle = std::string(pair + key.size() + 1, strnlen(pair + key.size() + 1, pairSize - key.size() - 1));
+        position += (pairSize + 3) & ~3u;
+    }
+    position = keyValueEnd;
+
+    const BlockFormat format = static_cast<BlockFormat>(internalFormat);
+    const uint32_t levelCount = std::max(header[11], 1u);
+    int width = image.width, height = image.height;
+    image.levels.clear();
+    image.data.clear();
+    for (uint32_t i = 0; i < levelCount; ++i)
+    {
+        uint32_t size;
+        if (position + 4 > file.size())
+            return false;
+        std::memcpy(&size, file.data() + position, 4);
+        position += 4;
+        if (size != compressedLevelSize(format, width, height) || size > file.size() - position)
+            return false;
+        image.levels.push_back({ width, height, image.data.size() });
+        image.data.insert(image.data.end(), file.begin() + position, file.begin() + position + size);
+        position += (size + 3) & ~3u;
+        width = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+    }
+    return image.swizzle.size() == 4;
+}
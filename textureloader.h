@@ -0,0 +1,407 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "3rdparty/stb_image.h"
+#include "atlaspacker.h"
+#include "jobsystem.h"
+#include "mipchain.h"
+#include "texturecache.h"
+
+// copy a width x height image into target at rect, then repeat its edge
+// texels padding texels outwards so filtering at the border sees the sprite
+// instead of its neighbours or black
+inline void blitPadded(const unsigned char *source, int channels, unsigned char *target, int targetWidth,
+                       const AtlasRect &rect, int padding)
+{
+    for (int y = -padding; y < rect.height + padding; ++y)
+    {
+        const int sourceY = std::clamp(y, 0, rect.height - 1);
+        unsigned char *row = target + (static_cast<std::size_t>(rect.y + y) * targetWidth + rect.x) * channels;
+        for (int x = -padding; x < rect.width + padding; ++x)
+        {
+            const int sourceX = std::clamp(x, 0, rect.width - 1);
+            std::memcpy(row + x * channels, source + (static_cast<std::size_t>(sourceY) * rect.width + sourceX) * channels,
+                        channels);
+        }
+    }
+}
+
+// Loads textures without blocking the render thread. load() returns a
+// texture name at once, showing a transparent 1x1 placeholder. A JobSystem
+// background job decodes the file and builds its mip chain, and update()
+// streams the chain into a pixel unpack buffer, at most uploadBudget bytes a
+// frame. Once all of it sits in the buffer, GPU side copies replace the
+// placeholder, so a texture never shows half an image and a burst of new
+// sprites is spread over several frames instead of one long hitch.
+// loadAtlas() packs several images into one texture the same way, so
+// particles with different sprites still share one binding and draw call.
+// With a cache directory set, finished mip chains are kept in a
+// TextureCache and later runs map them instead of decoding again.
+class TextureLoader
+{
+public:
+
+    // bytes copied into pixel buffers per update, 4 MiB is ~1 ms of memcpy
+    static const std::size_t defaultUploadBudget = 4 * 1024 * 1024;
+    // border around every atlas sprite, enough for the first two mip levels
+    static const int atlasPadding = 4;
+    static const int maxAtlasSize = 4096;
+
+    explicit TextureLoader(JobSystem *jobSystem, std::size_t uploadBudget = defaultUploadBudget) :
+        m_jobSystem(jobSystem), m_uploadBudget(uploadBudget) {}
+
+    ~TextureLoader()
+    {
+        for (const std::shared_ptr<Request> &request : m_requests)
+            releaseBuffer(*request);
+    }
+
+    TextureLoader(const TextureLoader &) = delete;
+    TextureLoader &operator=(const TextureLoader &) = delete;
+
+    // where decoded mip chains are kept between runs, empty (the default)
+    // turns the cache off; applies to textures loaded afterwards
+    void setCacheDirectory(const std::string &directory) { m_cache = TextureCache(directory); }
+
+    // texture the image will end up in, the caller owns it; a file that
+    // fails to load keeps the placeholder
+    GLuint load(const std::string &path)
+    {
+        std::shared_ptr<Request> request = std::make_shared<Request>();
+        request->path = path;
+        // the job only touches the request and its copy of the cache, which it keeps alive itself
+        return queue(request, [request, cache = m_cache]() {
+            std::vector<unsigned char> file;
+            if (!readFile(request->path, file))
+                return;
+            const uint64_t key = hashBytes(file.data(), file.size(), hashBytes("image", 5));
+            if (readCache(cache, key, *request))
+                return;
+            int width, height, channels;
+            unsigned char *pixels = stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &width, &height, &channels, 0);
+            if (pixels)
+            {
+                buildMipChain(*request, pixels, width, height, channels);
+                stbi_image_free(pixels);
+                writeCache(cache, key, *request);
+            }
+        });
+    }
+
+    // one RGBA texture holding all of paths, see getSpriteRects for where
+    // each of them went; a file that fails to load leaves an empty sprite
+    GLuint loadAtlas(const std::vector<std::string> &paths)
+    {
+        std::shared_ptr<Request> request = std::make_shared<Request>();
+        for (const std::string &path : paths)
+            request->path += (request->path.empty() ? "" : ", ") + path;
+        return queue(request, [request, paths, cache = m_cache]() {
+            // the key covers every file and the layout parameters
+            std::vector<std::vector<unsigned char>> files(paths.size());
+            uint64_t key = hashBytes("atlas", 5);
+            const int layout[2] = { atlasPadding, maxAtlasSize };
+            key = hashBytes(layout, sizeof(layout), key);
+            bool complete = true;
+            for (std::size_t i = 0; i < paths.size(); ++i)
+            {
+                complete = readFile(paths[i], files[i]) && complete;
+                const uint64_t size = files[i].size();
+                key = hashBytes(&size, sizeof(size), key);
+                key = hashBytes(files[i].data(), files[i].size(), key);
+            }
+            if (complete && readCache(cache, key, *request))
+                return;
+
+            std::vector<unsigned char *> images(paths.size());
+            std::vector<AtlasRect> sizes(paths.size(), AtlasRect{ 0, 0, 1, 1 });
+            for (std::size_t i = 0; i < paths.size(); ++i)
+            {
+                int channels;
+                images[i] = stbi_load_from_memory(files[i].data(), static_cast<int>(files[i].size()),
+                                                  &sizes[i].width, &sizes[i].height, &channels, 4);
+                if (!images[i])
+                {
+                    request->failed.push_back(paths[i]);
+                    sizes[i] = { 0, 0, 1, 1 };
+                }
+            }
+
+            int width, height;
+            std::vector<AtlasRect> rects;
+            if (packAtlas(sizes, atlasPadding, maxAtlasSize, width, height, rects))
+            {
+                static const unsigned char transparent[4] = { 0, 0, 0, 0 };
+                std::vector<unsigned char> atlas(static_cast<std::size_t>(width) * height * 4, 0);
+                for (std::size_t i = 0; i < images.size(); ++i)
+                {
+                    blitPadded(images[i] ? images[i] : transparent, 4, atlas.data(), width, rects[i], atlasPadding);
+                    request->rects.emplace_back(static_cast<float>(rects[i].x) / width, static_cast<float>(rects[i].y) / height,
+                                                static_cast<float>(rects[i].width) / width, static_cast<float>(rects[i].height) / height);
+                }
+                buildMipChain(*request, atlas.data(), width, height, 4);
+                // a missing sprite isn't cached, so it shows up once the file is there
+                if (request->failed.empty())
+                    writeCache(cache, key, *request);
+            }
+            for (unsigned char *image : images)
+                stbi_image_free(image);
+        });
+    }
+
+    // once a frame on the GL thread: stage decoded images, oldest first,
+    // and swap in the ones that are complete
+    void update()
+    {
+        m_uploadedBytes = 0;
+        std::size_t budget = m_uploadBudget;
+        for (auto it = m_requests.begin(); it != m_requests.end() && budget > 0;)
+        {
+            Request &request = **it;
+            if (!request.decoded.load(std::memory_order_acquire))
+            {
+                ++it;
+                continue;
+            }
+            if (request.size() == 0)
+            {
+                std::cerr << "Failed to load texture: " << request.path << std::endl;
+                it = m_requests.erase(it);
+                continue;
+            }
+
+            const std::size_t copied = stage(request, budget);
+            budget -= copied;
+            m_uploadedBytes += copied;
+            if (request.staged < request.size())
+                break;
+            finish(request);
+            it = m_requests.erase(it);
+        }
+    }
+
+    // textures still showing their placeholder
+    std::size_t getPendingCount() const { return m_requests.size(); }
+    // bytes the last update copied into pixel buffers
+    std::size_t getUploadedBytes() const { return m_uploadedBytes; }
+    // texture coordinate rectangle (corner xy, size zw) of every sprite of
+    // a loadAtlas texture in path order, null until the atlas is complete
+    const std::vector<glm::vec4> *getSpriteRects(GLuint texture) const
+    {
+        auto it = m_spriteRects.find(texture);
+        return it != m_spriteRects.end() ? &it->second : nullptr;
+    }
+
+private:
+
+    struct Request
+    {
+        std::string path;
+        GLuint texture = 0;
+        std::chrono::steady_clock::time_point start;
+        // written by the decode job before decoded is set; the mip chain in
+        // pixels or in the mapped cache entry, empty if the file didn't load
+        std::vector<unsigned char> pixels;
+        TextureCache::Entry cached;
+        const unsigned char *texels = nullptr;
+        std::size_t bytes = 0;
+        bool fromCache = false;
+        std::vector<MipLevel> levels;
+        int channels = 0;
+        // atlas sprites and the files that left theirs empty
+        std::vector<glm::vec4> rects;
+        std::vector<std::string> failed;
+        double decodeTime = 0.0;
+        std::atomic<bool> decoded{false};
+        // pixel buffer mapped while the image is staged over several updates
+        GLuint buffer = 0;
+        unsigned char *mapped = nullptr;
+        std::size_t staged = 0;
+        unsigned int frames = 0;
+
+        std::size_t size() const { return bytes; }
+    };
+
+    // pixels followed by its smaller levels into the request, on the job
+    static void buildMipChain(Request &request, const unsigned char *pixels, int width, int height, int channels)
+    {
+        std::vector<MipLevel> &levels = request.levels;
+        request.pixels.resize(mipChainLevels(width, height, channels, levels));
+        std::memcpy(request.pixels.data(), pixels, static_cast<std::size_t>(width) * height * channels);
+        for (std::size_t i = 1; i < levels.size(); ++i)
+            downsampleImage(request.pixels.data() + levels[i - 1].offset, levels[i - 1].width, levels[i - 1].height,
+                            channels, request.pixels.data() + levels[i].offset);
+        request.channels = channels;
+        request.texels = request.pixels.data();
+        request.bytes = request.pixels.size();
+    }
+
+    // take the mip chain from the cache entry of key, false on a miss
+    static bool readCache(const TextureCache &cache, uint64_t key, Request &request)
+    {
+        if (cache.getDirectory().empty() || !cache.read(key, request.cached))
+            return false;
+        request.levels = request.cached.levels;
+        request.rects = request.cached.rects;
+        request.channels = request.cached.channels;
+        request.texels = request.cached.texels;
+        request.bytes = request.cached.size;
+        request.fromCache = true;
+        return true;
+    }
+
+    static void writeCache(const TextureCache &cache, uint64_t key, const Request &request)
+    {
+        if (!cache.getDirectory().empty() &&
+            !cache.write(key, request.channels, request.levels, request.rects, request.texels, request.bytes))
+            std::cerr << "[WARN] Failed to cache texture: " << request.path << std::endl;
+    }
+
+    // give the request its placeholder texture and run decode in the background
+    GLuint queue(const std::shared_ptr<Request> &request, std::function<void()> decode)
+    {
+        static const unsigned char placeholder[4] = { 255, 255, 255, 0 };
+
+        request->start = std::chrono::steady_clock::now();
+
+        GLint bound = 0;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+        glGenTextures(1, &request->texture);
+        glBindTexture(GL_TEXTURE_2D, request->texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(bound));
+
+        auto timed = [request, decode = std::move(decode)]() {
+            const auto start = std::chrono::steady_clock::now();
+            decode();
+            request->decodeTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            request->decoded.store(true, std::memory_order_release);
+        };
+        m_requests.push_back(request);
+        if (m_jobSystem)
+            m_jobSystem->submit(timed);
+        else
+            timed();
+        return request->texture;
+    }
+
+    // copy up to budget more bytes of the image into its pixel buffer; the
+    // buffer stays mapped between frames, nothing draws from it meanwhile
+    std::size_t stage(Request &request, std::size_t budget)
+    {
+        if (request.buffer == 0)
+        {
+            glGenBuffers(1, &request.buffer);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, request.buffer);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(request.size()), nullptr, GL_STREAM_DRAW);
+            request.mapped = static_cast<unsigned char*>(
+                glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(request.size()),
+                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            if (!request.mapped)
+            {
+                // no staging memory: finish uploads straight from texels, in one go
+                std::cerr << "[WARN] Failed to map pixel buffer, uploading directly: " << request.path << std::endl;
+                releaseBuffer(request);
+                request.staged = request.size();
+                return 0;
+            }
+        }
+
+        const std::size_t count = std::min(budget, request.size() - request.staged);
+        std::memcpy(request.mapped + request.staged, request.texels + request.staged, count);
+        request.staged += count;
+        ++request.frames;
+        return count;
+    }
+
+    // define the texture from the staged pixel buffer, the copy runs on the GPU;
+    // without one (the map failed) from texels, the copy runs here
+    void finish(Request &request)
+    {
+        GLenum format = GL_RGBA;
+        if (request.channels == 1)
+            format = GL_RED;
+        else if (request.channels == 2)
+            format = GL_RG;
+        else if (request.channels == 3)
+            format = GL_RGB;
+
+        GLint bound = 0;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+        if (request.buffer)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, request.buffer);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            request.mapped = nullptr;
+        }
+        glBindTexture(GL_TEXTURE_2D, request.texture);
+        // rows of 1 and 3 channel images aren't 4 byte aligned
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (std::size_t i = 0; i < request.levels.size(); ++i)
+        {
+            const MipLevel &level = request.levels[i];
+            const void *data = request.buffer ? (const void*)level.offset : request.texels + level.offset;
+            glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(i), format, level.width, level.height, 0, format, GL_UNSIGNED_BYTE,
+                         data);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(bound));
+        // GL keeps the storage until the copy is done
+        releaseBuffer(request);
+        request.pixels = std::vector<unsigned char>();
+        request.cached.file.close();
+        if (!request.rects.empty())
+            m_spriteRects[request.texture] = std::move(request.rects);
+        for (const std::string &path : request.failed)
+            std::cerr << "Failed to load texture: " << path << std::endl;
+
+        const double total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - request.start).count();
+        std::cerr << "Load texture: " << request.path << (request.fromCache ? " (read from cache in " : " (decoded in ")
+                  << request.decodeTime << " ms, staged over "
+                  << request.frames << " frames, ready after " << total << " ms)" << std::endl;
+    }
+
+    static void releaseBuffer(Request &request)
+    {
+        if (request.buffer == 0)
+            return;
+        if (request.mapped)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, request.buffer);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            request.mapped = nullptr;
+        }
+        glDeleteBuffers(1, &request.buffer);
+        request.buffer = 0;
+    }
+
+    JobSystem *m_jobSystem;
+    std::size_t m_uploadBudget;
+    TextureCache m_cache{ "" };
+    // in load order, until their texture is complete
+    std::deque<std::shared_ptr<Request>> m_requests;
+    std::size_t m_uploadedBytes = 0;
+    // of every complete atlas, by texture
+    std::map<GLuint, std::vector<glm::vec4>> m_spriteRects;
+};
@@ -0,0 +1,180 @@
+// Offline encoder of particle sprites into GPU block compressed KTX files,
+// loaded at run time with Texture::loadCompressedTexture. Picks BC4 for
+// alpha-only or gray opaque sprites, BC5 (RGTC) for gray sprites with alpha
+// and BC7 for color ones, unless --format says otherwise, and builds the
+// whole mip chain so nothing is generated on the GPU. A BC7 sprite also gets
+// its RGTC companion, output.rgtc.ktx, the fallback of contexts without BPTC.
+//
+// usage: sprite_encoder [--format auto|bc4|bc5|bc7] input.png output.ktx
+//
+// Prints the memory of the mip chain as RGBA8 and compressed, the bytes a
+// texel fetch reads from memory and the PSNR of the top level as blended.
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../3rdparty/stb_image.h"
+#include "../mipchain.h"
+#include "../texturecompress.h"
+
+static bool parseFormat(const std::string &name, bool *automatic, BlockFormat *format)
+{
+    *automatic = name == "auto";
+    if (name == "bc4")
+        *format = BlockFormat::BC4;
+    else if (name == "bc5")
+        *format = BlockFormat::BC5;
+    else if (name == "bc7")
+        *format = BlockFormat::BC7;
+    else if (!*automatic)
+        return false;
+    return true;
+}
+
+// the encoding of a format the user asked for, channels as classifySprite would pick them
+static SpriteEncoding forcedEncoding(BlockFormat format, const SpriteEncoding &automatic)
+{
+    if (format == automatic.format)
+        return automatic;
+    if (format == BlockFormat::BC7)
+        return { BlockFormat::BC7, { 0, 1 }, "rgba" };
+    if (format == BlockFormat::BC5)
+        return { BlockFormat::BC5, { 0, 3 }, "rrrg" };
+    return { BlockFormat::BC4, { 3, 3 }, "111r" };
+}
+
+// peak signal to noise ratio of two RGBA images as they blend, color
+// premultiplied by alpha, so the color of transparent texels doesn't count; in dB
+static double psnr(const unsigned char *a, const unsigned char *b, std::size_t texels)
+{
+    double error = 0.0;
+    for (std::size_t i = 0; i < texels; ++i)
+    {
+        const unsigned char *x = a + 4 * i, *y = b + 4 * i;
+        for (int c = 0; c < 3; ++c)
+        {
+            const double difference = (x[c] * x[3] - y[c] * y[3]) / 255.0;
+            error += difference * difference;
+        }
+        error += (x[3] - y[3]) * (x[3] - y[3]);
+    }
+    if (error == 0.0)
+        return INFINITY;
+    return 10.0 * std::log10(255.0 * 255.0 * 4 * texels / error);
+}
+
+// compress every level of the mip chain in rgba
+static KtxImage encodeImage(const unsigned char *rgba, int width, int height, const std::vector<MipLevel> &levels,
+                            const SpriteEncoding &encoding)
+{
+    KtxImage image;
+    image.internalFormat = static_cast<uint32_t>(encoding.format);
+    image.width = width;
+    image.height = height;
+    image.swizzle = encoding.swizzle;
+    for (const MipLevel &level : levels)
+    {
+        image.levels.push_back({ level.width, level.height, image.data.size() });
+        image.data.resize(image.data.size() + compressedLevelSize(encoding.format, level.width, level.height));
+        compressLevel(rgba + level.offset, level.width, level.height, encoding, image.data.data() + image.levels.back().offset);
+    }
+    return image;
+}
+
+static bool writeImage(const KtxImage &image, const std::string &path)
+{
+    const std::vector<unsigned char> file = writeKtx(image);
+    std::ofstream output(path, std::ios::binary | std::ios::trunc);
+    if (!output.write(reinterpret_cast<const char*>(file.data()), static_cast<std::streamsize>(file.size())))
+    {
+        fprintf(stderr, "failed to write %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    bool automatic = true;
+    BlockFormat format = BlockFormat::BC7;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--format" && i + 1 < argc)
+        {
+            if (!parseFormat(argv[++i], &automatic, &format))
+            {
+                fprintf(stderr, "unknown format %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else
+        {
+            paths.push_back(arg);
+        }
+    }
+    if (paths.size() != 2)
+    {
+        fprintf(stderr, "usage: %s [--format auto|bc4|bc5|bc7] input.png output.ktx\n", argv[0]);
+        return 1;
+    }
+
+    int width, height, channels;
+    unsigned char *pixels = stbi_load(paths[0].c_str(), &width, &height, &channels, 4);
+    if (!pixels)
+    {
+        fprintf(stderr, "failed to load %s\n", paths[0].c_str());
+        return 1;
+    }
+    std::vector<MipLevel> levels;
+    std::vector<unsigned char> rgba(mipChainLevels(width, height, 4, levels));
+    std::memcpy(rgba.data(), pixels, static_cast<std::size_t>(width) * height * 4);
+    stbi_image_free(pixels);
+    for (std::size_t i = 1; i < levels.size(); ++i)
+        downsampleImage(rgba.data() + levels[i - 1].offset, levels[i - 1].width, levels[i - 1].height, 4,
+                        rgba.data() + levels[i].offset);
+
+    const SpriteEncoding classified = classifySprite(rgba.data(), width, height);
+    const SpriteEncoding encoding = automatic ? classified : forcedEncoding(format, classified);
+
+    const KtxImage image = encodeImage(rgba.data(), width, height, levels, encoding);
+    if (!writeImage(image, paths[1]))
+        return 1;
+    // luminance and alpha in BC5 for contexts that can't sample BC7
+    std::string fallbackPath;
+    KtxImage fallback;
+    if (encoding.format == BlockFormat::BC7)
+    {
+        const std::vector<unsigned char> gray = luminanceImage(rgba.data(), rgba.size() / 4);
+        fallback = encodeImage(gray.data(), width, height, levels, rgtcFallbackEncoding);
+        fallbackPath = rgtcFallbackPath(paths[1]);
+        if (!writeImage(fallback, fallbackPath))
+            return 1;
+    }
+
+    std::vector<unsigned char> decoded(static_cast<std::size_t>(width) * height * 4);
+    decompressLevel(image.data.data(), width, height, encoding, decoded.data());
+    const double quality = psnr(rgba.data(), decoded.data(), decoded.size() / 4);
+    const double bitsPerTexel = 8.0 * blockBytes(encoding.format) / 16.0;
+    printf("%s: %dx%d, %zu levels, %s swizzle %s%s\n", paths[0].c_str(), width, height, levels.size(),
+           blockFormatName(encoding.format), encoding.swizzle, automatic ? "" : " (forced)");
+    printf("memory:    RGBA8 %.1f KiB -> %s %.1f KiB (%.1fx smaller)\n", rgba.size() / 1024.0,
+           blockFormatName(encoding.format), image.data.size() / 1024.0, static_cast<double>(rgba.size()) / image.data.size());
+    printf("bandwidth: 32 -> %.0f bits per texel fetched\n", bitsPerTexel);
+    printf("quality:   %.2f dB PSNR of level 0 as blended\n", quality);
+    printf("wrote %s\n", paths[1].c_str());
+    if (!fallbackPath.empty())
+    {
+        decompressLevel(fallback.data.data(), width, height, rgtcFallbackEncoding, decoded.data());
+        printf("fallback:  %s %.1f KiB, luminance and alpha, %.2f dB PSNR against the color sprite\n",
+               blockFormatName(rgtcFallbackEncoding.format), fallback.data.size() / 1024.0,
+               psnr(rgba.data(), decoded.data(), decoded.size() / 4));
+        printf("wrote %s\n", fallbackPath.c_str());
+    }
+    return 0;
+}
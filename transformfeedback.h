@@ -0,0 +1,192 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+#include <GL/glew.h>
+
+#include "shaders.hpp"
+#include "particlebackend.h"
+
+// particle record as laid out in the transform feedback buffers, matches the
+// captured outputs of shaderFeedbackUpdate
+struct FeedbackParticle {
+    glm::vec3 m_position;
+    glm::vec3 m_velocity;
+    glm::vec4 m_color;
+    float m_life;
+};
+
+// GPU-resident particle system. The whole particle state lives in two GL
+// buffers; every Update runs shaderFeedbackUpdate over one of them with the
+// rasterizer disabled and captures the result into the other, then the two
+// swap. The CPU only writes newly spawned particles, round robin over the
+// pool like ParticleSystem overrides particles when it is full.
+// Needs a GL 3.3 core context.
+class TransformFeedbackParticleSystem : public ParticleBackend
+{
+public:
+
+    TransformFeedbackParticleSystem(Shader shader, uint32_t amount) :
+        m_amount(amount), m_shader(shader) {}
+
+    ~TransformFeedbackParticleSystem()
+    {
+        glDeleteVertexArrays(2, m_updateVAO);
+        glDeleteVertexArrays(2, m_renderVAO);
+        glDeleteBuffers(2, m_stateVBO);
+        glDeleteBuffers(1, &m_quadVBO);
+        glDeleteProgram(m_updateShader.getShaderProgram());
+    }
+
+    void Initialize() override
+    {
+        m_updateShader.loadShader(shaderFeedbackUpdate, TypeShader::VERTEX_SHADER);
+        m_updateShader.setFeedbackVaryings({"outPosition", "outVelocity", "outColor", "outLife"});
+        m_updateShader.createShaderProgram();
+
+        float particle_quad[] = {
+            0.0f, 1.0f, 0.0f, 1.0f,
+            1.0f, 0.0f, 1.0f, 0.0f,
+            0.0f, 0.0f, 0.0f, 0.0f,
+
+            0.0f, 1.0f, 0.0f, 1.0f,
+            1.0f, 1.0f, 1.0f, 1.0f,
+            1.0f, 0.0f, 1.0f, 0.0f
+        };
+        glGenBuffers(1, &m_quadVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, m_quadVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(particle_quad), particle_quad, GL_STATIC_DRAW);
+
+        // both state buffers start out with dead default particles
+        std::vector<FeedbackParticle> particles(m_amount, FeedbackParticle{glm::vec3(0.0f), glm::vec3(0.0f), glm::vec4(1.0f), 0.0f});
+        glGenBuffers(2, m_stateVBO);
+        glGenVertexArrays(2, m_updateVAO);
+        glGenVertexArrays(2, m_renderVAO);
+        for (int i = 0; i < 2; ++i)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, m_stateVBO[i]);
+            glBufferData(GL_ARRAY_BUFFER, m_amount * sizeof(FeedbackParticle), particles.data(), GL_DYNAMIC_COPY);
+
+            // update pass reads one particle per vertex
+            glBindVertexArray(m_updateVAO[i]);
+            setStateAttributes(0, 0);
+
+            // render pass reads one particle per quad instance
+            glBindVertexArray(m_renderVAO[i]);
+            glBindBuffer(GL_ARRAY_BUFFER, m_quadVBO);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
+            glBindBuffer(GL_ARRAY_BUFFER, m_stateVBO[i]);
+            setStateAttributes(1, 1);
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // the first newParticles slots rain down like in ParticleSystem::Update
+    void Simulate(float dt, unsigned int newParticles, glm::vec3 offset) override
+    {
+        const int target = 1 - m_current;
+
+        m_updateShader.useShaderProgram();
+        m_updateShader.setUniformFloat("dt", dt);
+        m_updateShader.setUniformUint("rainCount", newParticles);
+        m_updateShader.setUniformUint("frame", m_frame++);
+
+        glEnable(GL_RASTERIZER_DISCARD);
+        glBindVertexArray(m_updateVAO[m_current]);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, m_stateVBO[target]);
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, 0, m_amount);
+        glEndTransformFeedback();
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+        glBindVertexArray(0);
+        glDisable(GL_RASTERIZER_DISCARD);
+
+        m_current = target;
+    }
+
+    // same spawn rules as ParticleSystem::AddParticles / respawnParticle
+    void AddParticles(short int type, glm::vec3 position, glm::vec3 velocity, float rotation, unsigned int newParticles, glm::vec3 offset) override
+    {
+        if (newParticles > m_amount)
+            newParticles = m_amount;
+
+        m_spawned.assign(newParticles, FeedbackParticle{glm::vec3(0.0f), glm::vec3(0.01f, 0.01f, 0.01f), glm::vec4(1.0f), 1.0f});
+
+        // write into the buffer the next Update reads, wrapping around the pool
+        glBindBuffer(GL_ARRAY_BUFFER, m_stateVBO[m_current]);
+        unsigned int first = m_amount - m_spawnCursor < newParticles ? m_amount - m_spawnCursor : newParticles;
+        glBufferSubData(GL_ARRAY_BUFFER, m_spawnCursor * sizeof(FeedbackParticle),
+                        first * sizeof(FeedbackParticle), m_spawned.data());
+        if (first < newParticles)
+        {
+            glBufferSubData(GL_ARRAY_BUFFER, 0, (newParticles - first) * sizeof(FeedbackParticle),
+                            m_spawned.data() + first);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        m_spawnCursor = (m_spawnCursor + newParticles) % m_amount;
+    }
+
+    void Render() override
+    {
+        // additive blending gives a 'glow' effect; alpha blending is drawn in pool order here
+        applyBlendMode();
+        m_shader.useShaderProgram();
+        glBindVertexArray(m_renderVAO[m_current]);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 6, m_amount);
+        glBindVertexArray(0);
+        m_drawCalls = 1;
+        // don't forget to reset to default blending mode
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+
+    ParticleBackendType getType() const override { return ParticleBackendType::TRANSFORM_FEEDBACK; }
+    Shader &getShader() override { return m_shader; }
+    unsigned int getDrawCalls() const override { return m_drawCalls; }
+    std::size_t getAllocatedParticles() const override { return m_amount; }
+
+    // buffer holding the current particle state
+    GLuint getStateBuffer() const { return m_stateVBO[m_current]; }
+
+private:
+
+    // position, velocity, color and life of the bound state buffer at locations first..first+3
+    void setStateAttributes(GLuint first, GLuint divisor)
+    {
+        const GLsizei stride = sizeof(FeedbackParticle);
+        glEnableVertexAttribArray(first + 0);
+        glVertexAttribPointer(first + 0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(FeedbackParticle, m_position));
+        glVertexAttribDivisor(first + 0, divisor);
+        if (divisor == 0)
+        {
+            // the render pass has no use for velocity
+            glEnableVertexAttribArray(first + 1);
+            glVertexAttribPointer(first + 1, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(FeedbackParticle, m_velocity));
+            ++first;
+        }
+        glEnableVertexAttribArray(first + 1);
+        glVertexAttribPointer(first + 1, 4, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(FeedbackParticle, m_color));
+        glVertexAttribDivisor(first + 1, divisor);
+        glEnableVertexAttribArray(first + 2);
+        glVertexAttribPointer(first + 2, 1, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(FeedbackParticle, m_life));
+        glVertexAttribDivisor(first + 2, divisor);
+    }
+
+    unsigned int m_amount;
+    unsigned int m_spawnCursor = 0;
+    unsigned int m_drawCalls = 0;
+    unsigned int m_frame = 0;
+    int m_current = 0;
+
+    GLuint m_stateVBO[2] = {0, 0};
+    GLuint m_updateVAO[2] = {0, 0};
+    GLuint m_renderVAO[2] = {0, 0};
+    GLuint m_quadVBO = 0;
+
+    Shader m_shader;
+    Shader m_updateShader;
+    std::vector<FeedbackParticle> m_spawned;
+};